@@ -19,32 +19,30 @@
 
 #include <stdlib.h>
 #include <argp.h>
+#include <algorithm>
 #include <string>
+#include <vector>
+
+#include "sweep_plan.hpp"
+#include "spectrum_frontend.hpp"
+#include "spectrum_pool.hpp"
+#include "fft_wisdom.hpp"
+#include "scan_options.hpp"
 
 class Arguments
 {
 public:
 	Arguments(int argc, char **argv) :
-		avg_size(1000),
 		start_freq(87000000.0),
 		end_freq(108000000.0),
-		sample_rate(2000000.0),
-		fft_width(1000.0),
+		range_given(false),
 		step(-1.0),
-		gain_a(0.0),
-		gain_if(0.0),
-		gain_m(0.0),
-		gain_total(0.0),
-		use_AGC(1)
+		offset_tuning(false),
+		round_fft(false)
 	{
 		argp_parse (&argp_i, argc, argv, 0, 0, this);
 	}
 
-	unsigned int get_avg_size()
-	{
-		return avg_size;
-	}
-
 	double get_start_freq()
 	{
 		return start_freq;
@@ -55,29 +53,19 @@ public:
 		return end_freq;
 	}
 
-	double get_sample_rate()
-	{
-		return sample_rate;
-	}
-
-	double get_fft_width()
-	{
-		return fft_width;
-	}
-
 	double get_step()
 	{
-		if (step < 0.0)
-			return sample_rate / 4.0; // I've found this to be a good choice (slightly faster might be / 3.0)
-		else
+		if (step >= 0.0)
 			return step;
+		if (settings.pfb)
+			return settings.sample_rate * spectrum_frontend::UsableFraction(true); //the filterbank leaves ~80% of the band usable
+		return settings.sample_rate / 4.0; // I've found this to be a good choice (slightly faster might be / 3.0)
 	}
 
-	double get_gain_a() { return gain_a; }
-	double get_gain_m() { return gain_m; }
-	double get_gain_if() { return gain_if; }
-	double get_gain_total() { return gain_total; }
-	int get_use_AGC() { return use_AGC; }
+	bool get_offset_tuning() { return offset_tuning; }
+	const scan_options &get_options() { return settings; }
+	const std::vector<sweep_segment> &get_segments() { return segments; }
+	const std::vector<std::string> &get_devices() { return devices; }
 
 private:
 	static error_t s_parse_opt(int key, char *arg, struct argp_state *state)
@@ -91,43 +79,145 @@ private:
 		switch (key)
 		{
 		case 'a':
-			avg_size = atoi(arg);
+			settings.avg_size = atoi(arg);
 			break;
 		case 'x':
 			start_freq = atof(arg) * 1000000.0; //MHz
+			range_given = true;
 			break;
 		case 'y':
 			end_freq = atof(arg) * 1000000.0; //MHz
+			range_given = true;
 			break;
 		case 'r':
-			sample_rate = atof(arg) * 1000000.0; //MSamples/s
+			settings.sample_rate = atof(arg) * 1000000.0; //MSamples/s
 			break;
 		case 'w':
-			fft_width = atoi(arg);
+			settings.fft_width = atoi(arg);
 			break;
 		case 'z':
 			step = atof(arg) * 1000000.0; //MHz
 			break;
 		case 'g':
-			gain_m = atof(arg);
+			settings.gain_m = atof(arg);
 			break;
 		case 'i':
-			gain_if = atof(arg);
+			settings.gain_if = atof(arg);
 			break;
 		case 't':
-			gain_a = atof(arg);
+			settings.gain_a = atof(arg);
 			break;
 		case 'G':
-			gain_total = atof(arg);
+			settings.gain_total = atof(arg);
 			break;
 		case 'A':
-			use_AGC = atoi(arg);
+			settings.use_AGC = atoi(arg);
+			break;
+		case 'O':
+			settings.overlap = atof(arg);
+			if (settings.overlap < 0.0 || settings.overlap >= 100.0)
+				argp_error(state, "overlap must be in the range 0 - 99 percent");
+			break;
+		case 'P':
+			settings.pfb = atoi(arg);
+			if (settings.pfb > 2)
+				argp_error(state, "filterbank oversampling must be 0 (off), 1 or 2");
+			break;
+		case 'S':
+			settings.settle_time = atof(arg) / 1000.0; //ms
+			if (settings.settle_time < 0.0)
+				argp_error(state, "settle time must not be negative");
+			break;
+		case 'L':
+			settings.log_segment_minutes = atoi(arg);
+			break;
+		case 'Q':
+			settings.quantize_log = true;
+			break;
+		case 'o':
+			offset_tuning = true;
+			break;
+		case 'T':
+			settings.tolerance = atof(arg); //dB
+			if (settings.tolerance < 0.0)
+				argp_error(state, "tolerance must not be negative");
+			break;
+		case 'm':
+			settings.min_avg_size = atoi(arg);
+			break;
+		case 'k':
+			settings.stats_path = arg;
+			break;
+		case 'K':
+			settings.stats_interval = atoi(arg);
+			break;
+		case 'R':
+			settings.record_dir = arg;
+			break;
+		case 'M':
+			settings.record_segment_mb = atoi(arg);
+			break;
+		case 'H':
+			settings.gain_memory_path = arg;
 			break;
 		case ARGP_KEY_ARG:
 			if (state->arg_num > 0)
 				argp_usage(state);
 			break;
+		case 'p':
+			plan_files.push_back(arg);
+			break;
+		case 's':
+			segment_specs.push_back(arg);
+			break;
+		case 'd':
+			devices.push_back(arg);
+			break;
+		case 'X':
+			if (!ParseResolutions(arg))
+				argp_error(state, "bad resolutions '%s', expected KHZ[,KHZ...] or none", arg);
+			break;
+		case 'F':
+			settings.fft_wisdom_path = arg;
+			break;
+		case 'E':
+			round_fft = true;
+			break;
+		case 'j':
+		{
+			int threads = atoi(arg);
+			if (threads < 0 || threads > static_cast<int>(spectrum_pool::max_threads))
+				argp_error(state, "FFT threads must be in the range 0 - %u", spectrum_pool::max_threads);
+			settings.fft_threads = threads;
+			break;
+		}
+		case 'D':
+			settings.detect_threshold = atof(arg);
+			break;
+		case 'N':
+			settings.events_only = true;
+			break;
+		case 'B':
+			settings.duty_level = atof(arg);
+			break;
+		case 'e':
+			settings.hold = true;
+			break;
+		case 'Z':
+			settings.persistence_step = atof(arg);
+			break;
 		case ARGP_KEY_END:
+			if (round_fft && settings.fft_width >= 1.0)
+			{
+				unsigned int efficient = efficient_fft_size(static_cast<unsigned int>(settings.fft_width));
+				printf("[*] FFT width %g -> %u, %.1f Hz resolution\n", settings.fft_width, efficient, settings.sample_rate / efficient);
+				settings.fft_width = efficient;
+			}
+			if (settings.events_only && settings.detect_threshold <= 0.0f)
+				argp_error(state, "-N publishes the signals -D finds, give a threshold");
+			BuildPlan(state); //after everything else, the default step depends on -r and -z
+			if (devices.empty())
+				devices.push_back(""); //whatever osmosdr finds first
 			break;
 		default:
 			return ARGP_ERR_UNKNOWN;
@@ -135,20 +225,97 @@ private:
 		return 0;
 	}
 
+	/* "KHZ[,KHZ...]", finest first; "none" for only the full resolution */
+	bool ParseResolutions(const char *arg)
+	{
+		settings.resolutions.clear();
+		if (std::string(arg) == "none")
+			return true;
+		std::string s(arg);
+		std::replace(s.begin(), s.end(), ',', ' ');
+		const char *p = s.c_str();
+		double khz;
+		int length;
+		while (sscanf(p, "%lf%n", &khz, &length) == 1)
+		{
+			if (khz <= 0.0)
+				return false;
+			settings.resolutions.push_back(khz * 1000.0);
+			p += length;
+		}
+		std::sort(settings.resolutions.begin(), settings.resolutions.end());
+		return !settings.resolutions.empty();
+	}
+
+	void BuildPlan(struct argp_state *state)
+	{
+		for (size_t i = 0; i < plan_files.size(); ++i)
+		{
+			int line = load_sweep_plan(plan_files[i].c_str(), segments);
+			if (line < 0)
+				argp_error(state, "can't read plan file %s", plan_files[i].c_str());
+			else if (line > 0)
+				argp_error(state, "%s:%d: expected START END [INTERVAL [PRIORITY [STEP [RBW]]]]", plan_files[i].c_str(), line);
+		}
+		for (size_t i = 0; i < segment_specs.size(); ++i)
+		{
+			sweep_segment segment;
+			if (!segment.Parse(segment_specs[i]))
+				argp_error(state, "bad segment '%s', expected START:END[:INTERVAL[:PRIORITY[:STEP[:RBW]]]]", segment_specs[i].c_str());
+			segments.push_back(segment);
+		}
+		if (segments.empty() || range_given) //-x/-y is swept in the background
+		{
+			sweep_segment segment;
+			segment.start = start_freq;
+			segment.end = end_freq;
+			segment.step = step >= 0.0 ? step : 0.0; //Finish picks the default
+			segment.interval = 0.0;
+			segment.priority = 0;
+			segment.resolution = 0.0;
+			segment.decimation = 1;
+			segment.lo_offset = 0.0;
+			segment.first = 0;
+			segment.bins = 0;
+			if (segment.start > segment.end)
+				argp_error(state, "start frequency is above the end frequency");
+			segments.push_back(segment);
+		}
+
+		for (size_t i = 0; i < segments.size(); ++i)
+		{
+			sweep_segment &segment = segments[i];
+			if (!segment.Finish(settings.sample_rate, settings.fft_width, get_step(), spectrum_frontend::UsableFraction(settings.pfb > 0), offset_tuning))
+			{
+				if (segment.resolution > 0.0)
+					argp_error(state, "%.1f - %.1f MHz: a resolution of %g Hz needs no zoom, use -w instead",
+						segment.start / 1000000.0, segment.end / 1000000.0, segment.resolution);
+				argp_error(state, "an FFT width of %g leaves nothing to offset tune into", settings.fft_width);
+			}
+			if (segment.decimation > 1)
+				printf("[*] zooming into %.1f - %.1f MHz: decimating by %u, %.1f Hz resolution\n", segment.start / 1000000.0,
+					segment.end / 1000000.0, segment.decimation, settings.sample_rate / segment.decimation / settings.fft_width);
+			else if (offset_tuning)
+				printf("[*] offset tuning %.1f - %.1f MHz: LO %.3f MHz below each centre, %u of %g bins published, %.3f MHz step\n",
+					segment.start / 1000000.0, segment.end / 1000000.0, segment.lo_offset / 1000000.0, segment.bins, settings.fft_width,
+					segment.step / 1000000.0);
+		}
+	}
+
 	static argp_option options[];
 	static argp argp_i;
 
-	unsigned int avg_size;
 	double start_freq;
 	double end_freq;
-	double sample_rate;
-	double fft_width;
+	bool range_given; //-x or -y on the command line
 	double step;
-	double gain_a;
-	double gain_if;
-	double gain_m;
-	double gain_total;
-	int use_AGC;
+	bool offset_tuning;
+	bool round_fft;
+	scan_options settings;
+	std::vector<std::string> plan_files;
+	std::vector<std::string> segment_specs;
+	std::vector<sweep_segment> segments;
+	std::vector<std::string> devices;
 };
 
 argp_option Arguments::options[] = {
@@ -163,6 +330,31 @@ argp_option Arguments::options[] = {
 	{"gain_ant", 't', "GAINANT", 0, "antenna gain"},
 	{"gain_total", 'G', "GAINTOTAL", 0, "total gain (overrides individual gains)"},
 	{"use_AGC", 'A', "USEAGC", 0, "use agc (0 - turn off, 1 - turn on, on by default)"},
+	{"overlap", 'O', "PERCENT", 0, "Overlap consecutive FFTs by PERCENT, Welch averaging (default: 0, e.g. 50 or 75)"},
+	{"pfb", 'P', "N", 0, "Polyphase filterbank instead of a windowed FFT, critically sampled (1) or 2x oversampled (2); default step becomes 0.8 * sample_rate"},
+	{"settle", 'S', "MS", 0, "Discard MS milliseconds of samples after every retune (default: 5)"},
+	{"log-segment", 'L', "MINUTES", 0, "Start a new binary dwell log in logs/ every MINUTES (default: 10)"},
+	{"quantize-log", 'Q', 0, 0, "Store dwell log bins as 16 bit hundredths of a dB instead of floats"},
+	{"offset-tuning", 'o', 0, 0, "Tune the LO below each dwell and publish only the usable bins above the DC spike; the default step becomes their width"},
+	{"tolerance", 'T', "DB", 0, "Adaptive dwell: stop averaging once every bin is known to within DB (95% confidence); -a becomes the maximum (default: 0, off)"},
+	{"plan", 'p', "FILE", 0, "Read sweep segments from FILE, one START END [INTERVAL [PRIORITY [STEP [RBW]]]] per line"},
+	{"segment", 's', "SEGMENT", 0, "Sweep START:END MHz every INTERVAL seconds, optionally with PRIORITY, STEP MHz (0 = default) and a zoomed resolution RBW kHz; repeatable"},
+	{"device", 'd', "ARGS", 0, "Scan with the osmosdr device ARGS, e.g. hackrf=0; repeat for more devices, the plan is split between them"},
+	{"min-average", 'm', "COUNT", 0, "Adaptive dwell: always average at least COUNT samples (default: 32)"},
+	{"stats", 'k', "FILE", 0, "Write per-dwell timing histograms (retune, settle, wait, average, publish, agc, converge) to FILE; empty for none (default: logs/timing.txt)"},
+	{"stats-interval", 'K', "SECONDS", 0, "Rewrite the timing stats every SECONDS, 0 for only on SIGUSR1 (default: 10)"},
+	{"record", 'R', "DIR", 0, "Record the raw IQ of every dwell to SigMF files in DIR; play them back with -d sigmf=DIR"},
+	{"record-segment", 'M', "MB", 0, "Start a new IQ recording after MB megabytes (default: 1024)"},
+	{"gain-memory", 'H', "FILE", 0, "Remember the AGC's gains per frequency in FILE and start every revisit with them, e.g. logs/gains.txt (default: none)"},
+	{"fft-wisdom", 'F', "FILE", 0, "Load FFTW plans from FILE at startup and save them back; empty for none (default: logs/fftw.wisdom)"},
+	{"round-fft", 'E', 0, 0, "Round the FFT width (-w) to the nearest power of two, FFTW's fastest sizes"},
+	{"detect", 'D', "DB", 0, "Look for signals DB above each dwell's noise floor, print new ones and publish them with the spectrum (default: 0, off)"},
+	{"events-only", 'N', 0, 0, "Publish only the signals -D finds, not the spectra, to shared memory and the dwell log"},
+	{"bursts", 'B', "DB", 0, "Publish the spectral kurtosis of every bin and its duty cycle DB above the noise (default: 0, off)"},
+	{"hold", 'e', 0, 0, "Also publish the max-hold and min-hold of every bin over each dwell, to shared memory and the dwell log"},
+	{"persistence", 'Z', "DB", 0, "Publish a persistence histogram of every dwell: how many FFTs put each bin at each level, levels DB apart from -130 dB (default: 0, off)"},
+	{"fft-threads", 'j', "N", 0, "Spread each device's FFTs over N threads; 0 picks one per core for FFTs of 4096 points and up (default: 0)"},
+	{"resolutions", 'X', "KHZ[,KHZ...]", 0, "Publish every dwell at these coarser resolutions too, by merging bins, e.g. 100,1000 for the monitor's detectors (default: none)"},
 	{0}
 };
 
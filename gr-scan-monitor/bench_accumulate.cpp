@@ -0,0 +1,153 @@
+/*
+	gr-scan - A GNU Radio signal scanner
+	Copyright (C) 2015 Jason A. Donenfeld <Jason@zx2c4.com>. All Rights Reserved.
+	Copyright (C) 2012  Nicholas Tomlinson
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* Cost of the per-bin extras in the accumulation pass: the plain kernel (sum
+ * and AGC statistics) against the ones that also keep the squares and duty cycle
+ * crossings (-B), the max-hold and min-hold (-e), and both, per FFT vector and
+ * for every instruction set the CPU has, with the added time in percent of the
+ * plain kernel's. The persistence histogram (-Z) is a pass of its own over the
+ * same vectors, so all of its time is added; it has the levels of 1 dB that fit
+ * into the shared memory at that width, none at the widest. The vectors come in
+ * batches the size the sink uses, so they are in cache as they would be after
+ * the FFT. First the mean spectral kurtosis and duty cycle of independent
+ * noise vectors: about 1, and about 0.015 for a level 10 dB over the noise (the
+ * mean below the mean of exponential noise is 0.42 of it, exp(-4.2) of the bins
+ * are above ten times that).
+ *
+ * usage: bench_accumulate [vectors] */
+
+#include <cfloat>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <vector>
+
+#include "spectrum_kernels.hpp"
+#include "spectrum_publisher.hpp"
+
+struct kernel_set
+{
+	const char *name;
+	accumulate_batch_fn kernels[4]; //indexed by the ACCUMULATE_ extras
+	persistence_batch_fn persistence;
+};
+
+/* CPU seconds to accumulate vectors vectors of length bins, batch at a time from input */
+static double Time(accumulate_batch_fn accumulate, const std::vector<float> &input, unsigned int length, unsigned int batch,
+	unsigned int vectors, std::vector<float> &acc, std::vector<float> &squares, std::vector<float> &crossings,
+	std::vector<float> &max, std::vector<float> &min)
+{
+	std::vector<vector_stats> stats(batch);
+	float threshold = 0.0f;
+	bin_moments moments = {&squares[0], &crossings[0], 10.0f, 0.0f};
+	bin_hold hold = {&max[0], &min[0]};
+	clock_t begin = clock();
+	for (unsigned int done = 0; done < vectors; done += batch)
+		accumulate(&acc[0], &input[0], batch, length, 11, length - 10, &threshold, &stats[0], &moments, &hold);
+	return static_cast<double>(clock() - begin) / CLOCKS_PER_SEC;
+}
+
+/* The same for the persistence histogram, levels of 1 dB with the noise in the middle */
+static double TimePersistence(persistence_batch_fn persistence, const std::vector<float> &input, unsigned int length, unsigned int batch,
+	unsigned int vectors, unsigned int levels)
+{
+	std::vector<uint16_t> counts(static_cast<size_t>(length) * levels, 0);
+	std::vector<float> db(length);
+	std::vector<uint32_t> level(length);
+	clock_t begin = clock();
+	for (unsigned int done = 0; done < vectors; done += batch)
+		persistence(&counts[0], &input[0], batch, length, levels / 2.0f, 1.0f, levels, &db[0], &level[0]);
+	return static_cast<double>(clock() - begin) / CLOCKS_PER_SEC;
+}
+
+int main(int argc, char **argv)
+{
+	const unsigned int vectors = argc > 1 ? atoi(argv[1]) : 20000;
+	const unsigned int lengths[] = {1000, 8192, 65536};
+
+	std::vector<kernel_set> kernels;
+	kernel_set scalar = {"scalar", {accumulate_batch_scalar<0>, accumulate_batch_scalar<1>, accumulate_batch_scalar<2>, accumulate_batch_scalar<3> }, persistence_batch_scalar};
+	kernels.push_back(scalar);
+#ifdef SPECTRUM_KERNELS_X86
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("sse2"))
+	{
+		kernel_set sse = {"sse2", {accumulate_batch_sse<0>, accumulate_batch_sse<1>, accumulate_batch_sse<2>, accumulate_batch_sse<3> }, persistence_batch_sse};
+		kernels.push_back(sse);
+	}
+	if (__builtin_cpu_supports("avx2"))
+	{
+		kernel_set avx2 = {"avx2", {accumulate_batch_avx2<0>, accumulate_batch_avx2<1>, accumulate_batch_avx2<2>, accumulate_batch_avx2<3> }, persistence_batch_avx2};
+		kernels.push_back(avx2);
+	}
+#endif
+
+	/* sanity: 500 independent vectors of exponential noise, the |X|^2 of complex noise */
+	{
+		const unsigned int length = 1000, count = 500;
+		std::vector<float> input(count * length), acc(length, 0.0f), squares(length, 0.0f), crossings(length, 0.0f);
+		for (size_t i = 0; i < input.size(); ++i)
+			input[i] = static_cast<float>(-log(1.0 - drand48()));
+		std::vector<vector_stats> stats(count);
+		float threshold = 0.0f;
+		bin_moments moments = {&squares[0], &crossings[0], 10.0f, FLT_MAX};
+		select_accumulate_batch(ACCUMULATE_MOMENTS)(&acc[0], &input[0], count, length, 11, length - 10, &threshold, &stats[0], &moments, NULL);
+		std::vector<float> kurtosis(length), duty(length);
+		finalize_moments(&kurtosis[0], &duty[0], &acc[0], &squares[0], &crossings[0], length, count);
+		double sk = 0.0, dc = 0.0;
+		for (unsigned int i = 0; i < length; ++i)
+		{
+			sk += kurtosis[i];
+			dc += duty[i];
+		}
+		printf("noise: mean SK %.3f, mean duty cycle %.2e\n", sk / length, dc / length);
+	}
+
+	printf("%8s %8s %16s %18s %18s %18s %18s\n", "bins", "kernel", "plain ns/vector", "+moments ns (%)", "+hold ns (%)", "+both ns (%)", "+persist ns (%)");
+	for (unsigned int l = 0; l < sizeof(lengths) / sizeof(lengths[0]); ++l)
+	{
+		const unsigned int length = lengths[l];
+		const unsigned int batch = length < 16384 ? 16384 / length : 1; //what scanner_sink's m_spectra holds
+		std::vector<float> input(batch * length);
+		for (size_t i = 0; i < input.size(); ++i)
+			input[i] = static_cast<float>(-log(1.0 - drand48())); //|X|^2 of complex noise
+		const unsigned int count = (vectors + batch - 1) / batch * batch;
+		const unsigned int levels = spectrum_publisher::PersistenceLevels(length, 0, 128); //what scanner_sink keeps
+
+		for (size_t k = 0; k < kernels.size(); ++k)
+		{
+			double cpu[5];
+			for (unsigned int e = 0; e < 4; ++e)
+			{
+				std::vector<float> acc(length, 0.0f), squares(length, 0.0f), crossings(length, 0.0f), max(length, 0.0f), min(length, FLT_MAX);
+				cpu[e] = Time(kernels[k].kernels[e], input, length, batch, count, acc, squares, crossings, max, min);
+			}
+			cpu[4] = levels > 0 ? TimePersistence(kernels[k].persistence, input, length, batch, count, levels) : 0.0;
+			printf("%8u %8s %16.1f", length, kernels[k].name, 1e9 * cpu[0] / count);
+			for (unsigned int e = 1; e < 5; ++e)
+			{
+				double added = e < 4 ? cpu[e] - cpu[0] : cpu[e]; //the persistence pass comes on top
+				printf(" %10.1f (%+4.0f%%)", 1e9 * cpu[e] / count, cpu[0] > 0 ? 100.0 * added / cpu[0] : 0.0);
+			}
+			printf(" %3u levels\n", levels);
+		}
+	}
+	return 0;
+}
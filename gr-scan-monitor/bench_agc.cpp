@@ -0,0 +1,137 @@
+/*
+	gr-scan - A GNU Radio signal scanner
+	Copyright (C) 2015 Jason A. Donenfeld <Jason@zx2c4.com>. All Rights Reserved.
+	Copyright (C) 2012  Nicholas Tomlinson
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+/* How long the AGC spends stepping towards the right gain per sweep, with and
+ * without the gain memory (-H), through the real pipeline and the synthetic
+ * source. Both runs sweep the same plan; the first sweep with memory fills the
+ * table, so the comparison is over the sweeps after it. Settling is counted in
+ * sample time (vectors until the AGC's last step in each dwell, at the device's
+ * rate), which is what it costs on hardware however fast the CPU runs here.
+ *
+ * usage: bench_agc [sweeps] [start_mhz] [end_mhz] [sample_rate_msps] [fft_width] [avg_size] [device] */
+
+#include <cstdio>
+#include <cstdlib>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "topblock.hpp"
+
+struct agc_result
+{
+	double converge_ms; //settling per sweep, after the first
+	double steps; //set_gain calls per sweep, after the first
+	double dwells; //per sweep, to average over
+};
+
+static void WaitForDwells(TopBlock &top_block, uint64_t dwells)
+{
+	while (top_block.timing()->Count(0, scan_stats::PHASE_DWELL) < dwells)
+		usleep(1000);
+}
+
+static agc_result Run(const std::string &device, const sweep_segment &segment, double sample_rate, unsigned int fft_width,
+	unsigned int avg_size, unsigned int sweeps, const std::string &gain_memory_path)
+{
+	scan_options options; //gr-scan's defaults, without the files it keeps in logs/
+	options.sample_rate = sample_rate;
+	options.fft_width = fft_width;
+	options.avg_size = avg_size;
+	options.stats_path = "";
+	options.gain_memory_path = gain_memory_path;
+	options.fft_wisdom_path = "";
+	TopBlock top_block(std::vector<std::string>(1, device), std::vector<sweep_segment>(1, segment), options);
+	scan_stats_sptr timing = top_block.timing();
+
+	top_block.start();
+	WaitForDwells(top_block, segment.Dwells()); //first sweep: the memory learns, the AGC without it starts cold
+	double converge = timing->Total(0, scan_stats::PHASE_CONVERGE);
+	uint64_t steps = timing->Count(0, scan_stats::PHASE_AGC);
+	uint64_t still = timing->Count(0, scan_stats::PHASE_DWELL);
+	WaitForDwells(top_block, static_cast<uint64_t>(sweeps) * segment.Dwells());
+	top_block.stop();
+	top_block.wait();
+
+	agc_result result;
+	result.converge_ms = (timing->Total(0, scan_stats::PHASE_CONVERGE) - converge) / 1e6 / (sweeps - 1);
+	result.steps = static_cast<double>(timing->Count(0, scan_stats::PHASE_AGC) - steps) / (sweeps - 1);
+	result.dwells = static_cast<double>(timing->Count(0, scan_stats::PHASE_DWELL) - still) / (sweeps - 1);
+	return result;
+}
+
+int main(int argc, char **argv)
+{
+	const unsigned int sweeps = argc > 1 ? atoi(argv[1]) : 3;
+	const double start = (argc > 2 ? atof(argv[2]) : 100.0) * 1000000.0;
+	const double end = (argc > 3 ? atof(argv[3]) : 2600.0) * 1000000.0;
+	const double sample_rate = (argc > 4 ? atof(argv[4]) : 20.0) * 1000000.0;
+	const unsigned int fft_width = argc > 5 ? atoi(argv[5]) : 1000;
+	const unsigned int avg_size = argc > 6 ? atoi(argv[6]) : 1000;
+	const std::string device = argc > 7 ? argv[7] : "synth";
+	if (sweeps < 2 || start > end || fft_width < 32 || avg_size < 1)
+	{
+		fprintf(stderr, "usage: %s [sweeps >= 2] [start_mhz] [end_mhz] [sample_rate_msps] [fft_width >= 32] [avg_size] [device]\n", argv[0]);
+		return 1;
+	}
+
+	sweep_segment segment;
+	segment.start = start;
+	segment.end = end;
+	segment.step = 0.0;
+	segment.interval = 0.0;
+	segment.priority = 0;
+	segment.resolution = 0.0;
+	segment.decimation = 1;
+	segment.lo_offset = 0.0;
+	segment.first = 0;
+	segment.bins = 0;
+	segment.Finish(sample_rate, fft_width, sample_rate / 4.0, spectrum_frontend::UsableFraction(false), false);
+
+	printf("%s, %.1f - %.1f MHz, %.1f Msps, fft_width %u, avg_size %u, %u sweeps of %u dwells\n", device.c_str(),
+		start / 1000000.0, end / 1000000.0, sample_rate / 1000000.0, fft_width, avg_size, sweeps, segment.Dwells());
+	fflush(stdout);
+
+	char path[] = "/tmp/bench_agc_XXXXXX";
+	int fd = mkstemp(path);
+	if (fd < 0)
+	{
+		perror("mkstemp");
+		return 1;
+	}
+	close(fd);
+	unlink(path); //gain_memory starts empty when the file isn't there
+
+	int console = dup(2); //the per-dwell lines on stderr would drown the report
+	int null = open("/dev/null", O_WRONLY);
+	dup2(null, 2);
+	agc_result cold = Run(device, segment, sample_rate, fft_width, avg_size, sweeps, "");
+	agc_result remembered = Run(device, segment, sample_rate, fft_width, avg_size, sweeps, path);
+	dup2(console, 2);
+	close(null);
+	unlink(path);
+
+	/* a sweep on hardware takes at least its samples */
+	double capture_ms = 1000.0 * segment.Dwells() * avg_size * fft_width / sample_rate;
+	printf("%-12s %16s %14s %14s %16s\n", "gain memory", "settle ms/sweep", "% of capture", "steps/sweep", "ms/dwell");
+	printf("%-12s %16.1f %14.1f %14.1f %16.3f\n", "off", cold.converge_ms, 100.0 * cold.converge_ms / capture_ms,
+		cold.steps, cold.converge_ms / cold.dwells);
+	printf("%-12s %16.1f %14.1f %14.1f %16.3f\n", "on", remembered.converge_ms, 100.0 * remembered.converge_ms / capture_ms,
+		remembered.steps, remembered.converge_ms / remembered.dwells);
+	printf("settling removed: %.1f ms per sweep\n", cold.converge_ms - remembered.converge_ms);
+	return 0;
+}
@@ -0,0 +1,81 @@
+/*
+	gr-scan - A GNU Radio signal scanner
+	Copyright (C) 2015 Jason A. Donenfeld <Jason@zx2c4.com>. All Rights Reserved.
+	Copyright (C) 2012  Nicholas Tomlinson
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+/* FFT throughput against the number of spectrum_pool threads, 1 to N: power
+ * spectra per second, the sample rate that sustains, and the speed-up over one
+ * thread. Batches are as large as the scanner makes them for this width.
+ *
+ * usage: bench_fft_threads [fft_width] [sample_rate_msps] [max_threads] [pfb] */
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+#include "spectrum_pool.hpp"
+#include "scan_stats.hpp"
+
+int main(int argc, char **argv)
+{
+	const unsigned int fft_width = argc > 1 ? atoi(argv[1]) : 16384;
+	const double sample_rate = (argc > 2 ? atof(argv[2]) : 20.0) * 1000000.0;
+	const unsigned int max_threads = argc > 3 ? atoi(argv[3]) : boost::thread::hardware_concurrency();
+	const unsigned int pfb = argc > 4 ? atoi(argv[4]) : 0;
+	const uint64_t run_ns = 1000000000ULL; //per thread count
+	if (fft_width < 32 || max_threads < 1 || pfb > 2)
+	{
+		fprintf(stderr, "usage: %s [fft_width >= 32] [sample_rate_msps] [max_threads >= 1] [pfb 0-2]\n", argv[0]);
+		return 1;
+	}
+
+	std::vector<float> window = pfb ? spectrum_frontend::GetPfbWindow(fft_width, 8) : spectrum_frontend::GetWindow(fft_width);
+	spectrum_frontend_sptr prototype(new spectrum_frontend(fft_width, window, pfb ? fft_width / pfb : 0));
+
+	printf("fft_width %u%s, %.1f Msps, %u cores\n", fft_width, pfb ? ", filterbank" : "", sample_rate / 1000000.0,
+		boost::thread::hardware_concurrency());
+	printf("%8s %8s %14s %12s %10s %10s %10s\n", "threads", "batch", "spectra/s", "Msps", "realtime", "speed-up", "per core");
+	double single = 0.0;
+	for (unsigned int t = 1; t <= max_threads; ++t)
+	{
+		spectrum_pool pool(prototype, t);
+		const unsigned int batch = std::max(fft_width < 16384 ? 16384 / fft_width : 1, t); //what scanner_sink uses
+		std::vector<gr_complex> samples((batch - 1) * prototype->hop() + prototype->span());
+		for (size_t i = 0; i < samples.size(); ++i)
+			samples[i] = gr_complex(drand48() - 0.5, drand48() - 0.5);
+		std::vector<float> spectra(batch * fft_width);
+
+		pool.Start();
+		pool.Transform(&samples[0], batch, &spectra[0]); //wake everything up once
+		uint64_t vectors = 0, begin = scan_stats_now(), elapsed = 0;
+		while (elapsed < run_ns)
+		{
+			pool.Transform(&samples[0], batch, &spectra[0]);
+			vectors += batch;
+			elapsed = scan_stats_now() - begin;
+		}
+		pool.Stop();
+
+		double rate = vectors * 1e9 / elapsed;
+		double msps = rate * prototype->hop() / 1000000.0;
+		if (t == 1)
+			single = rate;
+		printf("%8u %8u %14.0f %12.1f %9.2fx %9.2fx %9.0f%%\n", t, batch, rate, msps, msps * 1000000.0 / sample_rate,
+			rate / single, 100.0 * rate / single / t);
+	}
+	return 0;
+}
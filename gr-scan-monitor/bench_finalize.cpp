@@ -0,0 +1,98 @@
+/*
+	gr-scan - A GNU Radio signal scanner
+	Copyright (C) 2015 Jason A. Donenfeld <Jason@zx2c4.com>. All Rights Reserved.
+	Copyright (C) 2012  Nicholas Tomlinson
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* Dwell finalization, old vs. new: the per-bin branchy fftshift with a divide,
+ * then 10*log10 per bin (what scanner_sink::WriteDwell used to do), against
+ * finalize_dwell with the fast log. Also reports the worst difference between
+ * the fast log and log10f over the whole positive float range.
+ *
+ * usage: bench_finalize [dwells] */
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <vector>
+
+#include "spectrum_kernels.hpp"
+
+static void OldFinalize(float *bands, const float *buffer, unsigned int length, unsigned int count, float gain)
+{
+	for (unsigned int i = 0; i < length; ++i)
+	{
+		if (i < length / 2)
+			bands[i + length / 2] = buffer[i] / static_cast<float>(count);
+		else
+			bands[i - length / 2] = buffer[i] / static_cast<float>(count);
+	}
+	for (unsigned int n = 0; n < length; n++)
+		bands[n] = 10*log10(bands[n]) - 38.0 - gain;
+}
+
+int main(int argc, char **argv)
+{
+	const unsigned int dwells = argc > 1 ? atoi(argv[1]) : 200;
+	const unsigned int lengths[] = {1000, 8192, 65536};
+	const unsigned int count = 1000;
+	const float gain = 20.0f;
+	log_db_fn log_db = select_log_db();
+
+	/* accuracy: every 97th float between FLT_MIN and 1e30 */
+	float worst = 0.0f, worst_at = 0.0f;
+	for (uint32_t bits = 0x00800000; bits < 0x7149f2ca; bits += 97)
+	{
+		float x, db;
+		memcpy(&x, &bits, sizeof(x));
+		log_db(&db, &x, 1, 0.0f);
+		float err = fabsf(db - 10.0f * log10f(x));
+		if (err > worst)
+		{
+			worst = err;
+			worst_at = x;
+		}
+	}
+	printf("fast log vs log10f: max error %.2e dB (at %g)\n", worst, worst_at);
+
+	printf("%8s %14s %14s %10s %14s\n", "bins", "old us/dwell", "new us/dwell", "speedup", "max diff dB");
+	for (unsigned int l = 0; l < sizeof(lengths) / sizeof(lengths[0]); ++l)
+	{
+		const unsigned int length = lengths[l];
+		std::vector<float> buffer(length), old_bands(length), new_bands(length);
+		for (unsigned int i = 0; i < length; ++i)
+			buffer[i] = count * (0.001f + static_cast<float>(drand48()));
+
+		clock_t begin = clock();
+		for (unsigned int d = 0; d < dwells; ++d)
+			OldFinalize(&old_bands[0], &buffer[0], length, count, gain);
+		double old_cpu = static_cast<double>(clock() - begin) / CLOCKS_PER_SEC;
+
+		const float offset = -10.0f * log10f(static_cast<float>(count)) - 38.0f - gain;
+		begin = clock();
+		for (unsigned int d = 0; d < dwells; ++d)
+			finalize_dwell(log_db, &new_bands[0], &buffer[0], length, offset);
+		double new_cpu = static_cast<double>(clock() - begin) / CLOCKS_PER_SEC;
+
+		float diff = 0.0f;
+		for (unsigned int i = 0; i < length; ++i)
+			diff = fmaxf(diff, fabsf(old_bands[i] - new_bands[i]));
+		printf("%8u %14.2f %14.2f %9.1fx %14.2e\n", length, 1e6 * old_cpu / dwells, 1e6 * new_cpu / dwells,
+			new_cpu > 0 ? old_cpu / new_cpu : 0.0, diff);
+	}
+	return 0;
+}
@@ -0,0 +1,109 @@
+/*
+	gr-scan - A GNU Radio signal scanner
+	Copyright (C) 2015 Jason A. Donenfeld <Jason@zx2c4.com>. All Rights Reserved.
+	Copyright (C) 2012  Nicholas Tomlinson
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+/* The window, FFT and |X|^2 of spectrum_frontend against the GNU Radio chain it
+ * replaced, stream_to_vector -> fft_vcc -> complex_to_mag_squared, on the same
+ * noise with a few carriers in it. Reports how many bins came out bit for bit
+ * the same and the worst difference relative to the mean power of its vector,
+ * and fails if that is over the tolerance (FFTW may pick a different algorithm
+ * for the two plans, so the last bits can differ).
+ *
+ * usage: bench_frontend [vectors] [fft_width] */
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+#include <gnuradio/top_block.h>
+#include <gnuradio/blocks/vector_source_c.h>
+#include <gnuradio/blocks/stream_to_vector.h>
+#include <gnuradio/fft/fft_vcc.h>
+#include <gnuradio/blocks/complex_to_mag_squared.h>
+#include <gnuradio/blocks/vector_sink_f.h>
+
+#include "spectrum_frontend.hpp"
+
+int main(int argc, char **argv)
+{
+	const unsigned int vectors = argc > 1 ? atoi(argv[1]) : 200;
+	const unsigned int fft_width = argc > 2 ? atoi(argv[2]) : 1000;
+	const double tolerance = 1e-5;
+	if (vectors < 1 || fft_width < 32)
+	{
+		fprintf(stderr, "usage: %s [vectors] [fft_width >= 32]\n", argv[0]);
+		return 1;
+	}
+
+	std::vector<gr_complex> samples(static_cast<size_t>(vectors) * fft_width);
+	for (size_t i = 0; i < samples.size(); ++i)
+	{
+		double r = sqrt(-2.0 * log(1.0 - drand48())), phi = 2.0 * M_PI * drand48();
+		gr_complex noise(0.01 * r * cos(phi), 0.01 * r * sin(phi));
+		samples[i] = noise + std::polar(1.0f, static_cast<float>(0.1 * i)) + std::polar(0.001f, static_cast<float>(-2.3 * i));
+	}
+	std::vector<float> window = spectrum_frontend::GetWindow(fft_width);
+
+	/* The old chain, as TopBlock used to connect it */
+	gr::top_block_sptr chain = gr::make_top_block("bench_frontend");
+	gr::blocks::vector_source_c::sptr source = gr::blocks::vector_source_c::make(samples);
+	gr::blocks::stream_to_vector::sptr stv = gr::blocks::stream_to_vector::make(sizeof(float) * 2, fft_width);
+	gr::fft::fft_vcc::sptr fft = gr::fft::fft_vcc::make(fft_width, true, window, false, 1);
+	gr::blocks::complex_to_mag_squared::sptr ctf = gr::blocks::complex_to_mag_squared::make(fft_width);
+	gr::blocks::vector_sink_f::sptr sink = gr::blocks::vector_sink_f::make(fft_width);
+	chain->connect(source, 0, stv, 0);
+	chain->connect(stv, 0, fft, 0);
+	chain->connect(fft, 0, ctf, 0);
+	chain->connect(ctf, 0, sink, 0);
+	chain->run();
+	std::vector<float> expected = sink->data();
+	if (expected.size() != samples.size())
+	{
+		fprintf(stderr, "[!] the chain produced %zu values, expected %zu\n", expected.size(), samples.size());
+		return 1;
+	}
+
+	spectrum_frontend frontend(fft_width, window);
+	std::vector<float> power(fft_width);
+	size_t identical = 0;
+	double worst = 0.0;
+	for (unsigned int v = 0; v < vectors; ++v)
+	{
+		frontend.Transform(&samples[static_cast<size_t>(v) * fft_width], &power[0]);
+		const float *old = &expected[static_cast<size_t>(v) * fft_width];
+		double mean = 0.0;
+		for (unsigned int i = 0; i < fft_width; ++i)
+			mean += old[i];
+		mean /= fft_width;
+		for (unsigned int i = 0; i < fft_width; ++i)
+		{
+			identical += power[i] == old[i];
+			worst = std::max(worst, fabs(power[i] - old[i]) / mean);
+		}
+	}
+
+	printf("%u vectors of %u bins: %zu of %zu bins identical, worst difference %.3g of the mean power\n",
+		vectors, fft_width, identical, expected.size(), worst);
+	if (worst > tolerance)
+	{
+		fprintf(stderr, "[!] spectrum_frontend differs from stream_to_vector -> fft_vcc -> complex_to_mag_squared by more than %g\n", tolerance);
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,109 @@
+/*
+	gr-scan - A GNU Radio signal scanner
+	Copyright (C) 2015 Jason A. Donenfeld <Jason@zx2c4.com>. All Rights Reserved.
+	Copyright (C) 2012  Nicholas Tomlinson
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+/* HackRF samples through osmosdr (converted to gr_complex in the source block,
+ * then windowed by the frontend) against the native 8 bit path (kept as int8 I/Q
+ * until the frontend converts and windows them in one pass). Per dwell: the bytes
+ * written to and read from the buffer between source and sink, the bytes moved
+ * from the source's own buffer to the FFT input in all, the CPU time of the
+ * conversion, window, FFT and |X|^2, and how far apart the two spectra are.
+ *
+ * usage: bench_int8 [avg_size] [fft_width] [pfb] */
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <vector>
+
+#include "spectrum_frontend.hpp"
+
+int main(int argc, char **argv)
+{
+	const unsigned int avg_size = argc > 1 ? atoi(argv[1]) : 1000;
+	const unsigned int fft_width = argc > 2 ? atoi(argv[2]) : 1000;
+	const unsigned int pfb = argc > 3 ? atoi(argv[3]) : 0;
+	const unsigned int trials = 8;
+	if (avg_size < 1 || fft_width < 32 || pfb > 2)
+	{
+		fprintf(stderr, "usage: %s [avg_size] [fft_width >= 32] [pfb 0-2]\n", argv[0]);
+		return 1;
+	}
+
+	std::vector<float> window = pfb ? spectrum_frontend::GetPfbWindow(fft_width, 8) : spectrum_frontend::GetWindow(fft_width);
+	spectrum_frontend frontend(fft_width, window, pfb ? fft_width / pfb : 0);
+	const unsigned int samples = (avg_size - 1) * frontend.hop() + frontend.span();
+
+	std::vector<int8_t> raw(2 * samples); //what libhackrf hands over
+	for (size_t i = 0; i < raw.size(); ++i)
+		raw[i] = static_cast<int8_t>(lrint(20.0 * sqrt(-2.0 * log(1.0 - drand48())) * cos(2.0 * M_PI * drand48())));
+	std::vector<int8_t> buffer8(raw.size()); //the GNU Radio buffer between source and sink, either way
+	std::vector<gr_complex> buffer(samples);
+	std::vector<float> power(fft_width), acc(fft_width), acc8(fft_width);
+
+	double cpu = 0.0, cpu8 = 0.0;
+	for (unsigned int t = 0; t < trials; ++t)
+	{
+		std::fill(acc.begin(), acc.end(), 0.0f);
+		std::fill(acc8.begin(), acc8.end(), 0.0f);
+
+		clock_t begin = clock();
+		volk_8i_s32f_convert_32f(reinterpret_cast<float *>(&buffer[0]), &raw[0], 1.0f / spectrum_frontend::int8_scale(), 2 * samples);
+		for (unsigned int v = 0; v < avg_size; ++v)
+		{
+			frontend.Transform(&buffer[v * frontend.hop()], &power[0]);
+			for (unsigned int i = 0; i < fft_width; ++i)
+				acc[i] += power[i];
+		}
+		cpu += static_cast<double>(clock() - begin) / CLOCKS_PER_SEC;
+
+		begin = clock();
+		memcpy(&buffer8[0], &raw[0], raw.size());
+		for (unsigned int v = 0; v < avg_size; ++v)
+		{
+			frontend.Transform(&buffer8[2 * v * frontend.hop()], &power[0]);
+			for (unsigned int i = 0; i < fft_width; ++i)
+				acc8[i] += power[i];
+		}
+		cpu8 += static_cast<double>(clock() - begin) / CLOCKS_PER_SEC;
+	}
+
+	double worst = 0.0;
+	for (unsigned int i = 0; i < fft_width; ++i)
+		worst = std::max(worst, fabs(10.0 * log10(acc8[i] / acc[i])));
+
+	/* source buffer -> GNU Radio buffer -> FFT input: gr_complex is written and read
+	 * at 8 bytes a sample, int8 at 2, and the FFT input is floats either way. With
+	 * overlap or the filterbank the frontend reads span() samples per hop(). */
+	const double reads = static_cast<double>(avg_size) * frontend.span(); //samples the frontend reads
+	const double fft_in = 8.0 * reads; //what it writes, floats in both cases
+	const double buffer_bytes = 8.0 * samples + 8.0 * reads;
+	const double buffer_bytes8 = 2.0 * samples + 2.0 * reads;
+	const double total = 2.0 * samples + buffer_bytes + fft_in;
+	const double total8 = 2.0 * samples + buffer_bytes8 + fft_in;
+
+	printf("avg_size %u, fft_width %u%s, %u samples per dwell\n", avg_size, fft_width, pfb ? ", filterbank" : "", samples);
+	printf("%10s %16s %16s %14s\n", "path", "buffer MB/dwell", "total MB/dwell", "cpu ms/dwell");
+	printf("%10s %16.2f %16.2f %14.3f\n", "gr_complex", buffer_bytes / 1e6, total / 1e6, 1000.0 * cpu / trials);
+	printf("%10s %16.2f %16.2f %14.3f\n", "int8", buffer_bytes8 / 1e6, total8 / 1e6, 1000.0 * cpu8 / trials);
+	printf("%.1fx fewer bytes through the buffer, %.1fx fewer in all, %.2fx the speed; spectra within %.2g dB\n",
+		buffer_bytes / buffer_bytes8, total / total8, cpu / cpu8, worst);
+	return 0;
+}
@@ -0,0 +1,108 @@
+/*
+	gr-scan - A GNU Radio signal scanner
+	Copyright (C) 2015 Jason A. Donenfeld <Jason@zx2c4.com>. All Rights Reserved.
+	Copyright (C) 2012  Nicholas Tomlinson
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* Windowed FFT vs. polyphase filterbank: CPU per dwell, the bandwidth each dwell
+ * contributes (the default step of each front end), and from that the MHz swept
+ * per second once retune time is included. Leakage is the strongest bin 3 or more
+ * bins away from a tone halfway between two bins, scalloping the level difference
+ * between a tone on a bin and one halfway between two.
+ *
+ * usage: bench_pfb [avg_size] [fft_width] [sample_rate_msps] [retune_ms] */
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <vector>
+
+#include "spectrum_frontend.hpp"
+
+/* Power spectrum of a unit tone offset bins from DC */
+static void ToneSpectrum(spectrum_frontend &frontend, double offset, std::vector<float> &power)
+{
+	const unsigned int n = frontend.vector_length();
+	std::vector<gr_complex> samples(frontend.span());
+	for (size_t i = 0; i < samples.size(); ++i)
+		samples[i] = gr_complex(cos(2.0 * M_PI * offset * i / n), sin(2.0 * M_PI * offset * i / n));
+	frontend.Transform(&samples[0], &power[0]);
+}
+
+int main(int argc, char **argv)
+{
+	const unsigned int avg_size = argc > 1 ? atoi(argv[1]) : 1000;
+	const unsigned int fft_width = argc > 2 ? atoi(argv[2]) : 1000;
+	const double sample_rate = (argc > 3 ? atof(argv[3]) : 20.0) * 1000000.0;
+	const double retune = (argc > 4 ? atof(argv[4]) : 5.0) / 1000.0;
+	const unsigned int trials = 4;
+	if (avg_size < 1 || fft_width < 32)
+	{
+		fprintf(stderr, "usage: %s [avg_size] [fft_width >= 32] [sample_rate_msps] [retune_ms]\n", argv[0]);
+		return 1;
+	}
+
+	struct config { const char *name; unsigned int taps; unsigned int oversample; };
+	const config configs[] = { {"fft", 1, 1}, {"pfb", 8, 1}, {"pfb x2", 8, 2} };
+
+	std::vector<float> power(fft_width), acc(fft_width);
+	printf("avg_size %u, fft_width %u, %.1f Msps, %.1f ms per retune\n", avg_size, fft_width, sample_rate / 1000000.0, retune * 1000.0);
+	printf("%8s %14s %14s %12s %12s %12s %12s\n", "front", "samples/dwell", "cpu ms/dwell", "step MHz", "MHz/s", "leakage dB", "scallop dB");
+	for (unsigned int c = 0; c < sizeof(configs) / sizeof(configs[0]); ++c)
+	{
+		const config &cfg = configs[c];
+		bool pfb = cfg.taps > 1;
+		std::vector<float> window = pfb ? spectrum_frontend::GetPfbWindow(fft_width, cfg.taps) : spectrum_frontend::GetWindow(fft_width);
+		spectrum_frontend frontend(fft_width, window, fft_width / cfg.oversample);
+		const unsigned int dwell_samples = (avg_size - 1) * frontend.hop() + frontend.span();
+
+		std::vector<gr_complex> samples(dwell_samples);
+		for (size_t i = 0; i < samples.size(); ++i)
+			samples[i] = gr_complex(drand48() - 0.5, drand48() - 0.5);
+
+		double cpu = 0.0;
+		for (unsigned int t = 0; t < trials; ++t)
+		{
+			clock_t begin = clock();
+			for (unsigned int v = 0; v < avg_size; ++v)
+			{
+				frontend.Transform(&samples[v * frontend.hop()], &power[0]);
+				for (unsigned int i = 0; i < fft_width; ++i)
+					acc[i] += power[i];
+			}
+			cpu += static_cast<double>(clock() - begin) / CLOCKS_PER_SEC;
+		}
+		cpu /= trials;
+
+		/* the sink keeps up as long as the CPU is faster than the samples arrive */
+		double capture = dwell_samples / sample_rate;
+		double dwell_time = (cpu > capture ? cpu : capture) + retune;
+		double step = pfb ? sample_rate * spectrum_frontend::UsableFraction(true) : sample_rate / 4.0;
+
+		ToneSpectrum(frontend, 0.5, power);
+		float peak = power[0] > power[1] ? power[0] : power[1];
+		float leak = 0.0f;
+		for (unsigned int i = 3; i < fft_width - 2; ++i)
+			leak = power[i] > leak ? power[i] : leak;
+		ToneSpectrum(frontend, 0.0, power);
+		float centred = power[0];
+
+		printf("%8s %14u %14.3f %12.2f %12.1f %12.1f %12.2f\n", cfg.name, dwell_samples, 1000.0 * cpu,
+			step / 1000000.0, step / 1000000.0 / dwell_time, 10.0 * log10(leak / peak), 10.0 * log10(centred / peak));
+	}
+	return 0;
+}
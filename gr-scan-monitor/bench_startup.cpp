@@ -0,0 +1,133 @@
+/*
+	gr-scan - A GNU Radio signal scanner
+	Copyright (C) 2015 Jason A. Donenfeld <Jason@zx2c4.com>. All Rights Reserved.
+	Copyright (C) 2012  Nicholas Tomlinson
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+/* Launch to first published dwell: how long TopBlock takes to build (FFT planning
+ * is most of it) and how long until the first dwell comes out, with the synthetic
+ * source so no hardware start-up is counted. Each FFT width runs cold (no wisdom
+ * anywhere) and warm (wisdom loaded from the -F file the cold run saved); the -w
+ * width is compared with what -E would round it to.
+ *
+ * usage: bench_startup [fft_width] [sample_rate_msps] [avg_size] [device] */
+
+#include <cstdio>
+#include <cstdlib>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "topblock.hpp"
+
+struct startup_result
+{
+	double construct_ms; //TopBlock's constructor, FFT plans included
+	double first_dwell_ms; //from before the constructor to the first published dwell
+};
+
+static startup_result Run(const std::string &device, double sample_rate, unsigned int fft_width, unsigned int avg_size,
+	const std::string &wisdom_path)
+{
+	sweep_segment segment;
+	segment.start = 100000000.0;
+	segment.end = 200000000.0;
+	segment.step = 0.0;
+	segment.interval = 0.0;
+	segment.priority = 0;
+	segment.resolution = 0.0;
+	segment.decimation = 1;
+	segment.lo_offset = 0.0;
+	segment.first = 0;
+	segment.bins = 0;
+	segment.Finish(sample_rate, fft_width, sample_rate / 4.0, spectrum_frontend::UsableFraction(false), false);
+
+	{
+		gr::fft::planner::scoped_lock lock(gr::fft::planner::mutex());
+		fftwf_forget_wisdom(); //whatever the previous run planned
+	}
+
+	scan_options options; //gr-scan's defaults, without the files it keeps in logs/
+	options.sample_rate = sample_rate;
+	options.fft_width = fft_width;
+	options.avg_size = avg_size;
+	options.stats_path = "";
+	options.fft_wisdom_path = wisdom_path;
+
+	startup_result result;
+	uint64_t begin = scan_stats_now();
+	TopBlock top_block(std::vector<std::string>(1, device), std::vector<sweep_segment>(1, segment), options);
+	result.construct_ms = (scan_stats_now() - begin) / 1e6;
+	top_block.start();
+	while (top_block.timing()->Count(0, scan_stats::PHASE_PUBLISH) < 1)
+		usleep(100);
+	result.first_dwell_ms = (scan_stats_now() - begin) / 1e6;
+	top_block.stop();
+	top_block.wait();
+	return result;
+}
+
+int main(int argc, char **argv)
+{
+	const unsigned int fft_width = argc > 1 ? atoi(argv[1]) : 1000;
+	const double sample_rate = (argc > 2 ? atof(argv[2]) : 20.0) * 1000000.0;
+	const unsigned int avg_size = argc > 3 ? atoi(argv[3]) : 100;
+	const std::string device = argc > 4 ? argv[4] : "synth";
+	if (fft_width < 32 || avg_size < 1)
+	{
+		fprintf(stderr, "usage: %s [fft_width >= 32] [sample_rate_msps] [avg_size] [device]\n", argv[0]);
+		return 1;
+	}
+
+	/* gr::fft keeps its own wisdom in $HOME/.gr_fftw_wisdom; a HOME of our own keeps
+	 * it from making the cold runs warm (and keeps ours out of the user's) */
+	char home[] = "/tmp/bench_startup_XXXXXX";
+	if (!mkdtemp(home))
+	{
+		perror("mkdtemp");
+		return 1;
+	}
+	setenv("HOME", home, 1);
+	const std::string gr_wisdom = std::string(home) + "/.gr_fftw_wisdom";
+	const std::string wisdom = std::string(home) + "/fftw.wisdom";
+
+	std::vector<unsigned int> widths(1, fft_width);
+	if (efficient_fft_size(fft_width) != fft_width)
+		widths.push_back(efficient_fft_size(fft_width));
+
+	printf("%s, %.1f Msps, avg_size %u\n", device.c_str(), sample_rate / 1000000.0, avg_size);
+	printf("%10s %12s %8s %16s %18s\n", "fft_width", "RBW Hz", "wisdom", "construct ms", "first dwell ms");
+	fflush(stdout);
+	int console = dup(2); //the per-dwell lines on stderr would drown the report
+	int null = open("/dev/null", O_WRONLY);
+	for (size_t w = 0; w < widths.size(); ++w)
+	{
+		unlink(gr_wisdom.c_str());
+		unlink(wisdom.c_str());
+		for (int warm = 0; warm < 2; ++warm)
+		{
+			dup2(null, 2);
+			startup_result result = Run(device, sample_rate, widths[w], avg_size, wisdom);
+			dup2(console, 2);
+			unlink(gr_wisdom.c_str()); //only ours may help the warm run
+			printf("%10u %12.1f %8s %16.1f %18.1f\n", widths[w], sample_rate / widths[w], warm ? "warm" : "cold",
+				result.construct_ms, result.first_dwell_ms);
+			fflush(stdout);
+		}
+	}
+	close(null);
+	unlink(wisdom.c_str());
+	rmdir(home);
+	return 0;
+}
@@ -0,0 +1,122 @@
+/*
+	gr-scan - A GNU Radio signal scanner
+	Copyright (C) 2015 Jason A. Donenfeld <Jason@zx2c4.com>. All Rights Reserved.
+	Copyright (C) 2012  Nicholas Tomlinson
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* Full sweeps through the real pipeline (TopBlock, sink, finalizer, publisher)
+ * with the synthetic source (or any other device string, e.g. replay=FILE)
+ * instead of hardware, as fast as the CPU allows. Reports dwells and MHz swept
+ * per second and CPU per dwell, with the generator's own CPU taken out.
+ *
+ * usage: bench_sweep [sweeps] [start_mhz] [end_mhz] [sample_rate_msps] [fft_width] [avg_size] [device] [offset]
+ *
+ * offset 1 sweeps offset tuned (-o), at its wider default step. */
+
+#include <cstdio>
+#include <cstdlib>
+#include <fcntl.h>
+#include <sys/resource.h>
+#include <unistd.h>
+
+#include "topblock.hpp"
+
+static double CpuSeconds()
+{
+	rusage usage;
+	getrusage(RUSAGE_SELF, &usage);
+	return usage.ru_utime.tv_sec + usage.ru_utime.tv_usec / 1e6 + usage.ru_stime.tv_sec + usage.ru_stime.tv_usec / 1e6;
+}
+
+int main(int argc, char **argv)
+{
+	const unsigned int sweeps = argc > 1 ? atoi(argv[1]) : 2;
+	const double start = (argc > 2 ? atof(argv[2]) : 100.0) * 1000000.0;
+	const double end = (argc > 3 ? atof(argv[3]) : 2600.0) * 1000000.0;
+	const double sample_rate = (argc > 4 ? atof(argv[4]) : 20.0) * 1000000.0;
+	const unsigned int fft_width = argc > 5 ? atoi(argv[5]) : 1000;
+	const unsigned int avg_size = argc > 6 ? atoi(argv[6]) : 100;
+	const std::string device = argc > 7 ? argv[7] : "synth";
+	const bool offset = argc > 8 && atoi(argv[8]) != 0;
+	const double settle = 0.005;
+	if (sweeps < 1 || start > end || fft_width < 32 || avg_size < 1)
+	{
+		fprintf(stderr, "usage: %s [sweeps] [start_mhz] [end_mhz] [sample_rate_msps] [fft_width >= 32] [avg_size] [device] [offset]\n", argv[0]);
+		return 1;
+	}
+
+	sweep_segment segment;
+	segment.start = start;
+	segment.end = end;
+	segment.step = 0.0;
+	segment.interval = 0.0;
+	segment.priority = 0;
+	segment.resolution = 0.0;
+	segment.decimation = 1;
+	segment.lo_offset = 0.0;
+	segment.first = 0;
+	segment.bins = 0;
+	segment.Finish(sample_rate, fft_width, sample_rate / 4.0, spectrum_frontend::UsableFraction(false), offset);
+	const uint64_t dwells = static_cast<uint64_t>(sweeps) * segment.Dwells();
+
+	printf("%s, %.1f - %.1f MHz, %.1f Msps, fft_width %u, avg_size %u, %u sweeps of %u dwells, %.3f MHz step%s\n", device.c_str(),
+		start / 1000000.0, end / 1000000.0, sample_rate / 1000000.0, fft_width, avg_size, sweeps, segment.Dwells(),
+		segment.step / 1000000.0, offset ? " (offset tuned)" : "");
+	fflush(stdout);
+
+	scan_options options; //gr-scan's defaults, without the files it keeps in logs/
+	options.sample_rate = sample_rate;
+	options.fft_width = fft_width;
+	options.avg_size = avg_size;
+	options.stats_path = "";
+	options.settle_time = settle;
+	options.fft_wisdom_path = "";
+	options.resolutions.push_back(100000.0); //-X 100,1000, what the monitor's detectors read
+	options.resolutions.push_back(1000000.0);
+	TopBlock top_block(std::vector<std::string>(1, device), std::vector<sweep_segment>(1, segment), options);
+	synthetic_source_sptr synthetic;
+	if (!top_block.scan_sources().empty())
+	{
+		block_scan_source<synthetic_source> *s = dynamic_cast<block_scan_source<synthetic_source> *>(top_block.scan_sources()[0].get());
+		if (s)
+			synthetic = s->source();
+	}
+
+	int console = dup(2); //the per-dwell lines on stderr would drown the report
+	int null = open("/dev/null", O_WRONLY);
+	dup2(null, 2);
+
+	double cpu_begin = CpuSeconds();
+	uint64_t begin = scan_stats_now();
+	top_block.start();
+	while (top_block.timing()->Count(0, scan_stats::PHASE_DWELL) < dwells)
+		usleep(1000);
+	double elapsed = (scan_stats_now() - begin) / 1e9;
+	double cpu = CpuSeconds() - cpu_begin;
+	double generator = synthetic ? synthetic->cpu_seconds() : 0.0;
+	top_block.stop();
+	top_block.wait();
+
+	dup2(console, 2);
+	close(null);
+
+	/* with hardware every dwell needs at least its samples and the settling time */
+	double realtime = (static_cast<double>(avg_size) * fft_width / sample_rate + settle);
+	printf("%12s %12s %14s %14s %14s\n", "dwells/s", "MHz/s", "cpu ms/dwell", "gen ms/dwell", "hw dwells/s");
+	printf("%12.1f %12.1f %14.3f %14.3f %14.1f\n", dwells / elapsed, dwells * segment.step / 1000000.0 / elapsed,
+		1000.0 * (cpu - generator) / dwells, 1000.0 * generator / dwells, 1.0 / realtime);
+	return 0;
+}
@@ -0,0 +1,105 @@
+/*
+	gr-scan - A GNU Radio signal scanner
+	Copyright (C) 2015 Jason A. Donenfeld <Jason@zx2c4.com>. All Rights Reserved.
+	Copyright (C) 2012  Nicholas Tomlinson
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* Plain vs. Welch (overlapped) averaging: for each overlap, how many samples
+ * one dwell captures, what that means for a full 100 - 6000 MHz sweep, and the
+ * normalized variance of the averaged spectrum of white noise. 1/variance is
+ * the number of independent FFTs the average is worth.
+ *
+ * usage: bench_welch [avg_size] [fft_width] [sample_rate_msps] */
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <vector>
+
+#include "spectrum_frontend.hpp"
+
+static void FillNoise(std::vector<gr_complex> &samples)
+{
+	for (size_t i = 0; i < samples.size(); ++i)
+	{
+		double u1 = drand48(), u2 = drand48();
+		double r = sqrt(-2.0 * log(u1 > 1e-12 ? u1 : 1e-12));
+		samples[i] = gr_complex(r * cos(2.0 * M_PI * u2), r * sin(2.0 * M_PI * u2));
+	}
+}
+
+int main(int argc, char **argv)
+{
+	const unsigned int avg_size = argc > 1 ? atoi(argv[1]) : 1000;
+	const unsigned int fft_width = argc > 2 ? atoi(argv[2]) : 1000;
+	const double sample_rate = (argc > 3 ? atof(argv[3]) : 20.0) * 1000000.0;
+	const double sweep_span = 5900000000.0; //100 - 6000 MHz
+	const unsigned int dwells_per_sweep = sweep_span / (sample_rate / 4.0); //default step
+	const unsigned int trials = 8;
+	const double overlaps[] = {0.0, 50.0, 75.0};
+	if (avg_size < 1 || fft_width < 32)
+	{
+		fprintf(stderr, "usage: %s [avg_size] [fft_width >= 32] [sample_rate_msps]\n", argv[0]);
+		return 1;
+	}
+
+	std::vector<float> window = spectrum_frontend::GetWindow(fft_width);
+	std::vector<float> power(fft_width), acc(fft_width);
+	std::vector<gr_complex> samples;
+
+	printf("avg_size %u, fft_width %u, %.1f Msps, %u dwells per sweep\n", avg_size, fft_width, sample_rate / 1000000.0, dwells_per_sweep);
+	printf("%8s %14s %14s %14s %12s %12s\n", "overlap", "samples/dwell", "sweep time s", "cpu ms/dwell", "norm. var", "equiv. avgs");
+	for (unsigned int o = 0; o < sizeof(overlaps) / sizeof(overlaps[0]); ++o)
+	{
+		spectrum_frontend frontend(fft_width, window, spectrum_frontend::GetHop(fft_width, overlaps[o]));
+		const unsigned int dwell_samples = (avg_size - 1) * frontend.hop() + fft_width;
+		samples.resize(dwell_samples);
+
+		double variance = 0.0, cpu = 0.0;
+		for (unsigned int t = 0; t < trials; ++t)
+		{
+			FillNoise(samples);
+			for (unsigned int i = 0; i < fft_width; ++i)
+				acc[i] = 0.0f;
+
+			clock_t begin = clock();
+			for (unsigned int v = 0; v < avg_size; ++v)
+			{
+				frontend.Transform(&samples[v * frontend.hop()], &power[0]);
+				for (unsigned int i = 0; i < fft_width; ++i)
+					acc[i] += power[i];
+			}
+			cpu += static_cast<double>(clock() - begin) / CLOCKS_PER_SEC;
+
+			/* white noise: every bin has the same distribution, so spread over bins is the estimator spread */
+			double sum = 0.0, sum2 = 0.0;
+			unsigned int n = 0;
+			for (unsigned int i = 10; i < fft_width - 10; ++i, ++n)
+			{
+				sum += acc[i];
+				sum2 += static_cast<double>(acc[i]) * acc[i];
+			}
+			double mean = sum / n;
+			variance += (sum2 / n - mean * mean) / (mean * mean);
+		}
+		variance /= trials;
+
+		printf("%7.0f%% %14u %14.2f %14.3f %12.6f %12.1f\n", overlaps[o], dwell_samples,
+			dwells_per_sweep * dwell_samples / sample_rate, 1000.0 * cpu / trials, variance, 1.0 / variance);
+	}
+	return 0;
+}
@@ -0,0 +1,83 @@
+/*
+	gr-scan - A GNU Radio signal scanner
+	Copyright (C) 2015 Jason A. Donenfeld <Jason@zx2c4.com>. All Rights Reserved.
+	Copyright (C) 2012  Nicholas Tomlinson
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* Zoom FFT vs. brute force: CPU time for one spectrum at the same resolution,
+ * either shift + decimate + fft_width point FFT, or one FFT decimation times
+ * wider over the same raw samples (of which only the zoomed part would be kept).
+ *
+ * usage: bench_zoom [fft_width] [sample_rate_msps] [spectra] */
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <vector>
+
+#include "spectrum_frontend.hpp"
+#include "zoom_stage.hpp"
+
+int main(int argc, char **argv)
+{
+	const unsigned int fft_width = argc > 1 ? atoi(argv[1]) : 1024;
+	const double sample_rate = (argc > 2 ? atof(argv[2]) : 20.0) * 1000000.0;
+	const unsigned int spectra = argc > 3 ? atoi(argv[3]) : 20;
+	const unsigned int decimations[] = {8, 32, 128};
+	if (fft_width < 32 || spectra < 1)
+	{
+		fprintf(stderr, "usage: %s [fft_width >= 32] [sample_rate_msps] [spectra]\n", argv[0]);
+		return 1;
+	}
+
+	printf("fft_width %u, %.1f Msps, %u spectra each\n", fft_width, sample_rate / 1000000.0, spectra);
+	printf("%10s %12s %16s %16s %10s\n", "decimate", "RBW Hz", "brute ms/spec", "zoom ms/spec", "speedup");
+	for (unsigned int d = 0; d < sizeof(decimations) / sizeof(decimations[0]); ++d)
+	{
+		const unsigned int decimation = decimations[d];
+		const unsigned int wide = fft_width * decimation;
+		std::vector<gr_complex> samples(static_cast<size_t>(wide) * spectra);
+		for (size_t i = 0; i < samples.size(); ++i)
+			samples[i] = gr_complex(drand48() - 0.5, drand48() - 0.5);
+		std::vector<float> power(wide);
+
+		spectrum_frontend brute(wide, spectrum_frontend::GetWindow(wide));
+		clock_t begin = clock();
+		for (unsigned int s = 0; s < spectra; ++s)
+			brute.Transform(&samples[static_cast<size_t>(s) * wide], &power[0]);
+		double brute_cpu = static_cast<double>(clock() - begin) / CLOCKS_PER_SEC;
+
+		spectrum_frontend narrow(fft_width, spectrum_frontend::GetWindow(fft_width));
+		zoom_stage zoom;
+		zoom.Configure(decimation, -0.25);
+		begin = clock();
+		for (unsigned int s = 0; s < spectra; ++s)
+		{
+			zoom.Push(&samples[static_cast<size_t>(s) * wide], wide);
+			while (zoom.size() >= fft_width)
+			{
+				narrow.Transform(zoom.data(), &power[0]);
+				zoom.Consume(fft_width);
+			}
+		}
+		double zoom_cpu = static_cast<double>(clock() - begin) / CLOCKS_PER_SEC;
+
+		printf("%10u %12.1f %16.3f %16.3f %9.1fx\n", decimation, sample_rate / wide,
+			1000.0 * brute_cpu / spectra, 1000.0 * zoom_cpu / spectra, zoom_cpu > 0 ? brute_cpu / zoom_cpu : 0.0);
+	}
+	return 0;
+}
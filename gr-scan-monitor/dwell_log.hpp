@@ -0,0 +1,388 @@
+/*
+	gr-scan - A GNU Radio signal scanner
+	Copyright (C) 2015 Jason A. Donenfeld <Jason@zx2c4.com>. All Rights Reserved.
+	Copyright (C) 2012  Nicholas Tomlinson
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef DWELL_LOG_HPP
+#define DWELL_LOG_HPP
+
+/* Append-only binary dwell log. One segment file per N minutes of scanning:
+ *
+ *   logs/dwells_<YYYYmmdd_HHMMSS>.bin   dwell_log_header, then dwell_log_record + bins, ...
+ *   logs/dwells_<YYYYmmdd_HHMMSS>.idx   dwell_log_header, then one dwell_log_index per record
+ *
+ * A segment opened in the same second as an existing one gets _1, _2, ... after
+ * the time, so every file is written by one run and starts with its header.
+ * All fields are in host byte order. Bin i of a record is at
+ * centre - span / 2 + i * span / bins Hz, in dB, lowest frequency first. With
+ * DWELL_FLAG_HOLD the bins are followed by the max-hold and then the min-hold of
+ * every bin over the dwell, in the same format.
+ * A DWELL_EVENTS record holds the signals found in a dwell instead, bins of them
+ * as dwell_log_event; it follows the dwell's spectrum, or stands in for it.
+ * gr-scan-log2txt turns segments back into the old signal_*.txt files. */
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/time.h>
+
+#include <cmath>
+#include <deque>
+#include <string>
+#include <vector>
+
+#define DWELL_LOG_VERSION 4 //2: dwell_log_record gained count, 3: DWELL_EVENTS records, 4: DWELL_FLAG_HOLD
+#define DWELL_LOG_MAGIC "GRSCANLG"
+#define DWELL_INDEX_MAGIC "GRSCANIX"
+#define DWELL_RECORD_MAGIC 0x4c455744 //"DWEL"
+
+enum
+{
+	DWELL_BINS_FLOAT = 0, //float dB
+	DWELL_BINS_Q16 = 1, //int16_t, hundredths of a dB
+	DWELL_EVENTS = 2 //dwell_log_event
+};
+
+enum
+{
+	DWELL_FLAG_HOLD = 1 //max-hold and min-hold follow the bins
+};
+
+struct dwell_log_header
+{
+	char magic[8];
+	uint32_t version;
+	uint32_t reserved;
+	int64_t session_start_us; //when the scanner started, microseconds since the epoch
+	int64_t segment_start_us; //when this segment was opened
+};
+
+struct dwell_log_record
+{
+	uint32_t magic;
+	uint32_t bins; //number of bins following the record
+	int64_t time_us; //end of the dwell, microseconds since the epoch
+	double centre; //centre frequency in Hz
+	double span; //width covered by the bins in Hz
+	float gain; //total gain in dB the dwell was taken with
+	uint16_t format; //DWELL_BINS_*
+	uint16_t flags; //DWELL_FLAG_*
+	uint32_t count; //number of FFTs averaged into the bins
+	uint32_t device; //which of the scanner's devices took the dwell, from 0
+};
+
+struct dwell_log_event
+{
+	double centre; //Hz
+	float bandwidth; //Hz
+	float peak; //dB
+	float snr; //dB above the dwell's noise floor
+	uint32_t reserved;
+};
+
+struct dwell_log_index
+{
+	int64_t time_us;
+	double centre;
+	uint64_t offset; //of the dwell_log_record in the .bin file
+};
+
+static inline int64_t dwell_log_now()
+{
+	timeval tv;
+	gettimeofday(&tv, NULL);
+	return static_cast<int64_t>(tv.tv_sec) * 1000000 + tv.tv_usec;
+}
+
+static inline size_t dwell_log_bin_size(uint16_t format)
+{
+	if (format == DWELL_EVENTS)
+		return sizeof(dwell_log_event);
+	return format == DWELL_BINS_Q16 ? sizeof(int16_t) : sizeof(float);
+}
+
+/* Bytes following a record */
+static inline size_t dwell_log_payload_size(const dwell_log_record &record)
+{
+	return record.bins * dwell_log_bin_size(record.format) * (record.flags & DWELL_FLAG_HOLD ? 3 : 1);
+}
+
+#ifndef DWELL_LOG_READER_ONLY
+#include <boost/bind.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread.hpp>
+
+/* Queues dwells from the finalizer and writes them on a thread of its own, so a
+ * slow disk never holds up the scan. If the disk can't keep up at all, dwells
+ * are dropped (and counted) rather than queued without bound. */
+class dwell_log
+{
+public:
+	dwell_log(const std::string &directory, unsigned int segment_minutes, bool quantize) :
+		m_directory(directory),
+		m_segment_us(static_cast<int64_t>(segment_minutes > 0 ? segment_minutes : 1) * 60 * 1000000),
+		m_format(quantize ? DWELL_BINS_Q16 : DWELL_BINS_FLOAT),
+		m_session_start(dwell_log_now()),
+		m_segment_start(0),
+		m_bin_file(-1),
+		m_index_file(-1),
+		m_offset(0),
+		m_dropped(0),
+		m_stop(false)
+	{
+	}
+
+	~dwell_log()
+	{
+		Stop();
+	}
+
+	void Start()
+	{
+		m_stop = false;
+		m_thread = boost::thread(boost::bind(&dwell_log::Run, this));
+	}
+
+	/* Writes out whatever is still queued, then closes the segment */
+	void Stop()
+	{
+		{
+			boost::lock_guard<boost::mutex> lock(m_mutex);
+			m_stop = true;
+		}
+		m_cond.notify_all();
+		if (m_thread.joinable())
+			m_thread.join();
+		CloseSegment();
+	}
+
+	/* Queues one dwell of bins (dB, lowest frequency first) averaged over ffts FFTs,
+	 * with the max-hold and min-hold of the same bins if they are given */
+	void Append(unsigned int device, double centre, double span, float gain, unsigned int ffts, const float *bins, unsigned int count,
+		const float *max_hold, const float *min_hold)
+	{
+		const bool hold = max_hold && min_hold;
+		std::vector<char> record = Record(m_format, hold ? DWELL_FLAG_HOLD : 0, device, centre, span, gain, ffts, count);
+		const size_t trace = count * dwell_log_bin_size(m_format);
+		Store(&record[sizeof(dwell_log_record)], bins, count);
+		if (hold)
+		{
+			Store(&record[sizeof(dwell_log_record) + trace], max_hold, count);
+			Store(&record[sizeof(dwell_log_record) + 2 * trace], min_hold, count);
+		}
+		Queue(record);
+	}
+
+	/* Queues the count signals found in a dwell */
+	void AppendEvents(unsigned int device, double centre, double span, float gain, unsigned int ffts, const dwell_log_event *events,
+		unsigned int count)
+	{
+		std::vector<char> record = Record(DWELL_EVENTS, 0, device, centre, span, gain, ffts, count);
+		if (count > 0)
+			memcpy(&record[sizeof(dwell_log_record)], events, count * sizeof(dwell_log_event));
+		Queue(record);
+	}
+
+private:
+	static const size_t max_queued = 256;
+
+	/* A record with its header filled in and room for count bins of format (and
+	 * whatever the flags add to them) */
+	static std::vector<char> Record(uint16_t format, uint16_t flags, unsigned int device, double centre, double span, float gain,
+		unsigned int ffts, unsigned int count)
+	{
+		dwell_log_record header;
+		header.magic = DWELL_RECORD_MAGIC;
+		header.bins = count;
+		header.time_us = dwell_log_now();
+		header.centre = centre;
+		header.span = span;
+		header.gain = gain;
+		header.format = format;
+		header.flags = flags;
+		header.count = ffts;
+		header.device = device;
+		std::vector<char> record(sizeof(header) + dwell_log_payload_size(header));
+		memcpy(&record[0], &header, sizeof(header));
+		return record;
+	}
+
+	/* Writes count bins in dB at out in the log's format */
+	void Store(char *out, const float *bins, unsigned int count) const
+	{
+		if (m_format == DWELL_BINS_Q16)
+		{
+			int16_t *q = reinterpret_cast<int16_t *>(out);
+			for (unsigned int i = 0; i < count; ++i)
+			{
+				float v = bins[i] * 100.0f;
+				q[i] = v > 32767.0f ? 32767 : v < -32768.0f ? -32768 : static_cast<int16_t>(lrintf(v));
+			}
+		}
+		else
+			memcpy(out, bins, count * sizeof(float));
+	}
+
+	void Queue(std::vector<char> &record)
+	{
+		{
+			boost::lock_guard<boost::mutex> lock(m_mutex);
+			if (m_queue.size() >= max_queued)
+			{
+				if (m_dropped++ % 100 == 0)
+					fprintf(stderr, "[!] dwell log can't keep up, %u dwells dropped\n", m_dropped);
+				return;
+			}
+			m_queue.push_back(std::vector<char>());
+			m_queue.back().swap(record);
+		}
+		m_cond.notify_all();
+	}
+
+	void Run()
+	{
+		boost::unique_lock<boost::mutex> lock(m_mutex);
+		for (;;)
+		{
+			while (m_queue.empty() && !m_stop)
+				m_cond.wait(lock);
+			if (m_queue.empty())
+				break;
+			std::vector<char> record;
+			record.swap(m_queue.front());
+			m_queue.pop_front();
+			lock.unlock();
+			Write(record);
+			lock.lock();
+		}
+	}
+
+	void Write(const std::vector<char> &record)
+	{
+		const dwell_log_record *header = reinterpret_cast<const dwell_log_record *>(&record[0]);
+		if (m_segment_start == 0 || header->time_us - m_segment_start >= m_segment_us)
+			OpenSegment(header->time_us); //if that fails, we try again with the next segment
+		if (m_bin_file < 0)
+			return;
+
+		dwell_log_index entry;
+		entry.time_us = header->time_us;
+		entry.centre = header->centre;
+		entry.offset = m_offset;
+		if (!WriteAll(m_bin_file, &record[0], record.size()))
+		{
+			fprintf(stderr, "[!] dwell log write failed\n");
+			CloseSegment(); //start a fresh segment rather than append after a torn record
+			m_segment_start = 0;
+			return;
+		}
+		m_offset += record.size();
+		if (!WriteAll(m_index_file, &entry, sizeof(entry)))
+			fprintf(stderr, "[!] dwell log index write failed\n");
+	}
+
+	void OpenSegment(int64_t now)
+	{
+		CloseSegment();
+		m_segment_start = now;
+		time_t seconds = now / 1000000;
+		struct tm tm;
+		localtime_r(&seconds, &tm);
+		char stamp[64];
+		strftime(stamp, sizeof(stamp), "%Y%m%d_%H%M%S", &tm);
+		std::string base = m_directory + "/dwells_" + stamp;
+
+		/* Never append to a segment someone else started: its header has their
+		 * session start and maybe another version */
+		std::string name = base;
+		for (unsigned int n = 1; n < 100; ++n)
+		{
+			m_bin_file = open((name + ".bin").c_str(), O_WRONLY | O_CREAT | O_EXCL, 0666);
+			if (m_bin_file >= 0 || errno != EEXIST)
+				break;
+			char suffix[16];
+			snprintf(suffix, sizeof(suffix), "_%u", n);
+			name = base + suffix;
+		}
+		if (m_bin_file >= 0)
+			m_index_file = open((name + ".idx").c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0666);
+		if (m_bin_file < 0 || m_index_file < 0)
+		{
+			fprintf(stderr, "[!] can't open dwell log %s.bin\n", name.c_str());
+			CloseSegment();
+			return;
+		}
+
+		dwell_log_header header;
+		memset(&header, 0, sizeof(header));
+		memcpy(header.magic, DWELL_LOG_MAGIC, sizeof(header.magic));
+		header.version = DWELL_LOG_VERSION;
+		header.session_start_us = m_session_start;
+		header.segment_start_us = now;
+		WriteAll(m_bin_file, &header, sizeof(header));
+		memcpy(header.magic, DWELL_INDEX_MAGIC, sizeof(header.magic));
+		WriteAll(m_index_file, &header, sizeof(header));
+		m_offset = sizeof(header);
+	}
+
+	void CloseSegment()
+	{
+		if (m_bin_file >= 0)
+			close(m_bin_file);
+		if (m_index_file >= 0)
+			close(m_index_file);
+		m_bin_file = m_index_file = -1;
+	}
+
+	static bool WriteAll(int fd, const void *data, size_t size)
+	{
+		const char *p = static_cast<const char *>(data);
+		while (size > 0)
+		{
+			ssize_t written = write(fd, p, size);
+			if (written <= 0)
+				return false;
+			p += written;
+			size -= written;
+		}
+		return true;
+	}
+
+	std::string m_directory;
+	int64_t m_segment_us; //length of one segment
+	uint16_t m_format;
+	int64_t m_session_start;
+	int64_t m_segment_start;
+	int m_bin_file;
+	int m_index_file;
+	uint64_t m_offset; //where the next record goes in m_bin_file
+	unsigned int m_dropped;
+	bool m_stop;
+	std::deque<std::vector<char> > m_queue;
+	boost::mutex m_mutex;
+	boost::condition_variable m_cond;
+	boost::thread m_thread;
+};
+
+typedef boost::shared_ptr<dwell_log> dwell_log_sptr;
+#endif
+
+#endif
@@ -0,0 +1,66 @@
+/*
+	gr-scan - A GNU Radio signal scanner
+	Copyright (C) 2015 Jason A. Donenfeld <Jason@zx2c4.com>. All Rights Reserved.
+	Copyright (C) 2012  Nicholas Tomlinson
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef FFT_WISDOM_HPP
+#define FFT_WISDOM_HPP
+
+#include <stdio.h>
+
+#include <string>
+
+#include <fftw3.h>
+#include <gnuradio/fft/fft.h>
+
+/* FFTW wisdom in a file of our own. gr::fft also keeps ~/.gr_fftw_wisdom, but that
+ * is shared with every other flowgraph (and unwritable for some users), so plans
+ * measured for our sizes are loaded from path before the frontends are made and
+ * written back once they are. Both take GNU Radio's planner lock: FFTW's planner
+ * isn't thread safe. */
+static inline bool load_fft_wisdom(const std::string &path)
+{
+	if (path.empty())
+		return false;
+	gr::fft::planner::scoped_lock lock(gr::fft::planner::mutex());
+	return fftwf_import_wisdom_from_filename(path.c_str()) != 0;
+}
+
+static inline bool save_fft_wisdom(const std::string &path)
+{
+	if (path.empty())
+		return false;
+	std::string tmp = path + ".tmp";
+	gr::fft::planner::scoped_lock lock(gr::fft::planner::mutex());
+	if (!fftwf_export_wisdom_to_filename(tmp.c_str()))
+	{
+		fprintf(stderr, "[!] can't save FFT wisdom to %s\n", tmp.c_str());
+		return false;
+	}
+	return rename(tmp.c_str(), path.c_str()) == 0;
+}
+
+/* The power of two nearest to n (the higher one on a tie): FFTW's fastest sizes */
+static inline unsigned int efficient_fft_size(unsigned int n)
+{
+	unsigned int lower = 1;
+	while (lower * 2 <= n)
+		lower *= 2;
+	return n - lower < lower * 2 - n ? lower : lower * 2;
+}
+
+#endif
@@ -0,0 +1,139 @@
+/*
+	gr-scan - A GNU Radio signal scanner
+	Copyright (C) 2015 Jason A. Donenfeld <Jason@zx2c4.com>. All Rights Reserved.
+	Copyright (C) 2012  Nicholas Tomlinson
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef GAIN_MEMORY_HPP
+#define GAIN_MEMORY_HPP
+
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+
+#include <cmath>
+#include <map>
+#include <string>
+#include <utility>
+
+#include <boost/shared_ptr.hpp>
+#include <boost/thread.hpp>
+
+/* The gains the AGC settled on at the end of each dwell, by device and LO, so the
+ * next visit starts there instead of stepping 8 dB per 200 FFTs from wherever the
+ * previous frequency left off. Kept in a text file, one "DEVICE LO_KHZ RF IF" per
+ * line, rewritten now and then from the finalizer thread (the scanner is usually
+ * stopped with ^C, so saving only on exit would lose everything). */
+class gain_memory
+{
+public:
+	gain_memory(const std::string &path) :
+		m_path(path),
+		m_dirty(false),
+		m_saved(time(NULL))
+	{
+		FILE *in = fopen(m_path.c_str(), "r");
+		if (!in)
+			return;
+		unsigned int device;
+		long long lo;
+		double rf, if_gain;
+		while (fscanf(in, "%u %lld %lf %lf", &device, &lo, &rf, &if_gain) == 4)
+			m_gains[std::make_pair(device, static_cast<int64_t>(lo))] = std::make_pair(rf, if_gain);
+		fclose(in);
+		printf("[*] %u remembered gains from %s\n", static_cast<unsigned int>(m_gains.size()), m_path.c_str());
+	}
+
+	/* Tuning thread: the gains to start a dwell at lo with, false if we have never been there */
+	bool Lookup(unsigned int device, double lo, double &rf, double &if_gain)
+	{
+		boost::lock_guard<boost::mutex> lock(m_mutex);
+		std::map<key, std::pair<double, double> >::const_iterator it = m_gains.find(Key(device, lo));
+		if (it == m_gains.end())
+			return false;
+		rf = it->second.first;
+		if_gain = it->second.second;
+		return true;
+	}
+
+	/* Sample thread: a dwell at lo ended with these gains */
+	void Store(unsigned int device, double lo, double rf, double if_gain)
+	{
+		boost::lock_guard<boost::mutex> lock(m_mutex);
+		std::pair<double, double> &gains = m_gains[Key(device, lo)];
+		if (gains.first != rf || gains.second != if_gain)
+		{
+			gains = std::make_pair(rf, if_gain);
+			m_dirty = true;
+		}
+	}
+
+	/* Finalizer thread: writes the table if it changed and the last save is a while ago */
+	void SaveIfDue()
+	{
+		{
+			boost::lock_guard<boost::mutex> lock(m_mutex);
+			if (!m_dirty || time(NULL) - m_saved < save_interval)
+				return;
+		}
+		Save();
+	}
+
+	void Save()
+	{
+		boost::lock_guard<boost::mutex> saving(m_save_mutex); //devices share the table and its temporary file
+		std::map<key, std::pair<double, double> > gains;
+		{
+			boost::lock_guard<boost::mutex> lock(m_mutex);
+			if (!m_dirty)
+				return;
+			gains = m_gains;
+			m_dirty = false;
+			m_saved = time(NULL);
+		}
+		std::string tmp = m_path + ".tmp";
+		FILE *out = fopen(tmp.c_str(), "w");
+		if (!out)
+		{
+			fprintf(stderr, "[!] can't save gains to %s\n", tmp.c_str());
+			return;
+		}
+		for (std::map<key, std::pair<double, double> >::const_iterator it = gains.begin(); it != gains.end(); ++it)
+			fprintf(out, "%u %lld %g %g\n", it->first.first, static_cast<long long>(it->first.second), it->second.first, it->second.second);
+		fclose(out);
+		rename(tmp.c_str(), m_path.c_str());
+	}
+
+private:
+	typedef std::pair<unsigned int, int64_t> key; //device, LO in kHz
+	static const time_t save_interval = 30; //seconds
+
+	static key Key(unsigned int device, double lo)
+	{
+		return std::make_pair(device, static_cast<int64_t>(floor(lo / 1000.0 + 0.5)));
+	}
+
+	std::string m_path;
+	std::map<key, std::pair<double, double> > m_gains; //RF, IF
+	bool m_dirty; //changed since the last save
+	time_t m_saved;
+	boost::mutex m_mutex;
+	boost::mutex m_save_mutex;
+};
+
+typedef boost::shared_ptr<gain_memory> gain_memory_sptr;
+
+#endif
@@ -0,0 +1,242 @@
+/*
+	gr-scan - A GNU Radio signal scanner
+	Copyright (C) 2015 Jason A. Donenfeld <Jason@zx2c4.com>. All Rights Reserved.
+	Copyright (C) 2012  Nicholas Tomlinson
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef HACKRF_SOURCE_HPP
+#define HACKRF_SOURCE_HPP
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <map>
+#include <string>
+#include <vector>
+
+#include <boost/shared_ptr.hpp>
+#include <boost/thread.hpp>
+
+#include <gnuradio/sync_block.h>
+#include <gnuradio/io_signature.h>
+#include <libhackrf/hackrf.h>
+
+/* A HackRF read with libhackrf directly, handing its samples on as they come off
+ * USB: interleaved int8 I/Q, 2 bytes per sample. osmosdr's source makes a gr_complex
+ * of every sample first, 8 bytes that every buffer after it then has to move; the
+ * scanner converts them itself when it windows them for the FFT. Gains and tuning
+ * work like osmosdr's HackRF source: "RF" is the 14 dB amplifier, "IF" the LNA (0 -
+ * 40 dB in 8 dB steps), "BB" the VGA (0 - 62 dB in 2 dB steps). */
+class hackrf_source : public gr::sync_block
+{
+public:
+	/* serial may be empty for the first HackRF found */
+	hackrf_source(const std::string &serial, double sample_rate) :
+		gr::sync_block("hackrf_source",
+			gr::io_signature::make(0, 0, 0),
+			gr::io_signature::make(1, 1, 2 * sizeof(int8_t))),
+		m_device(NULL),
+		m_ring(ring_bytes),
+		m_head(0),
+		m_fill(0),
+		m_overflows(0),
+		m_streaming(false),
+		m_freq(0.0)
+	{
+		hackrf_init();
+		int result = serial.empty() ? hackrf_open(&m_device) : hackrf_open_by_serial(serial.c_str(), &m_device);
+		if (result != HACKRF_SUCCESS)
+		{
+			fprintf(stderr, "[!] can't open HackRF %s: %s\n", serial.c_str(), hackrf_error_name(static_cast<hackrf_error>(result)));
+			exit(1);
+		}
+		if (!Check(hackrf_set_sample_rate(m_device, sample_rate), "setting the sample rate") ||
+			!Check(hackrf_set_baseband_filter_bandwidth(m_device, hackrf_compute_baseband_filter_bw(static_cast<uint32_t>(0.75 * sample_rate))),
+				"setting the baseband filter"))
+			exit(1);
+		set_gain(0.0, "RF");
+		set_gain(0.0, "IF");
+		set_gain(0.0, "BB");
+	}
+
+	~hackrf_source()
+	{
+		stop();
+		hackrf_close(m_device);
+		hackrf_exit();
+	}
+
+	/* If the HackRF doesn't start streaming, work() has nothing to wait for and ends the flowgraph */
+	virtual bool start()
+	{
+		{
+			boost::lock_guard<boost::mutex> lock(m_mutex);
+			m_head = m_fill = 0;
+		}
+		if (!Check(hackrf_start_rx(m_device, &hackrf_source::Received, this), "starting to receive"))
+			return false;
+		{
+			boost::lock_guard<boost::mutex> lock(m_mutex);
+			m_streaming = true;
+		}
+		return gr::sync_block::start();
+	}
+
+	virtual bool stop()
+	{
+		bool streaming;
+		{
+			boost::lock_guard<boost::mutex> lock(m_mutex);
+			streaming = m_streaming;
+			m_streaming = false;
+		}
+		m_cond.notify_all();
+		if (streaming)
+			hackrf_stop_rx(m_device);
+		return gr::sync_block::stop();
+	}
+
+	/* Returns the frequency the HackRF is at: the old one if tuning failed */
+	double set_center_freq(double freq)
+	{
+		if (!Check(hackrf_set_freq(m_device, static_cast<uint64_t>(freq + 0.5)), "tuning"))
+			return m_freq;
+		boost::lock_guard<boost::mutex> lock(m_mutex);
+		m_head = m_fill = 0; //whatever is queued was received before the retune
+		m_freq = freq;
+		return freq;
+	}
+
+	/* Overall gain goes to the amplifier, as with osmosdr */
+	double set_gain(double gain)
+	{
+		return set_gain(gain, "RF");
+	}
+
+	double set_gain(double gain, const std::string &name)
+	{
+		int result;
+		if (name == "RF")
+		{
+			gain = gain >= 7.0 ? 14.0 : 0.0;
+			result = hackrf_set_amp_enable(m_device, gain > 0.0 ? 1 : 0);
+		}
+		else if (name == "IF")
+		{
+			gain = 8.0 * static_cast<int>(std::min(std::max(gain, 0.0), 40.0) / 8.0);
+			result = hackrf_set_lna_gain(m_device, static_cast<uint32_t>(gain));
+		}
+		else if (name == "BB")
+		{
+			gain = 2.0 * static_cast<int>(std::min(std::max(gain, 0.0), 62.0) / 2.0);
+			result = hackrf_set_vga_gain(m_device, static_cast<uint32_t>(gain));
+		}
+		else
+			return 0.0;
+		if (!Check(result, "setting the gain"))
+			return get_gain(name); //still what it was
+		boost::lock_guard<boost::mutex> lock(m_mutex);
+		m_gains[name] = gain;
+		return gain;
+	}
+
+	double get_gain(const std::string &name)
+	{
+		boost::lock_guard<boost::mutex> lock(m_mutex);
+		return m_gains[name];
+	}
+
+	int work(int noutput_items, gr_vector_const_void_star &input_items, gr_vector_void_star &output_items)
+	{
+		int8_t *out = static_cast<int8_t *>(output_items[0]);
+		boost::unique_lock<boost::mutex> lock(m_mutex);
+		while (m_fill == 0 && m_streaming)
+			m_cond.wait(lock);
+		if (m_fill == 0)
+			return WORK_DONE;
+
+		size_t bytes = std::min<size_t>(2 * static_cast<size_t>(noutput_items), m_fill);
+		for (size_t done = 0; done < bytes;)
+		{
+			size_t chunk = std::min(bytes - done, m_ring.size() - m_head);
+			memcpy(out + done, &m_ring[m_head], chunk);
+			done += chunk;
+			m_head = (m_head + chunk) % m_ring.size();
+		}
+		m_fill -= bytes;
+		return bytes / 2;
+	}
+
+private:
+	static const size_t ring_bytes = 32 << 20; //0.8 s at 20 Msps
+
+	/* Reports a failed libhackrf call; true if it succeeded */
+	static bool Check(int result, const char *what)
+	{
+		if (result == HACKRF_SUCCESS)
+			return true;
+		fprintf(stderr, "[!] HackRF: %s failed: %s\n", what, hackrf_error_name(static_cast<hackrf_error>(result)));
+		return false;
+	}
+
+	static int Received(hackrf_transfer *transfer)
+	{
+		static_cast<hackrf_source *>(transfer->rx_ctx)->Push(reinterpret_cast<const int8_t *>(transfer->buffer), transfer->valid_length);
+		return 0;
+	}
+
+	/* libhackrf's thread: queues a transfer, or drops it if the scanner has fallen that far behind */
+	void Push(const int8_t *data, size_t bytes)
+	{
+		{
+			boost::lock_guard<boost::mutex> lock(m_mutex);
+			if (m_fill + bytes > m_ring.size())
+			{
+				if (m_overflows++ == 0)
+					fprintf(stderr, "[!] HackRF samples dropped, the scanner can't keep up\n");
+				return;
+			}
+			size_t tail = (m_head + m_fill) % m_ring.size();
+			for (size_t done = 0; done < bytes;)
+			{
+				size_t chunk = std::min(bytes - done, m_ring.size() - tail);
+				memcpy(&m_ring[tail], data + done, chunk);
+				done += chunk;
+				tail = (tail + chunk) % m_ring.size();
+			}
+			m_fill += bytes;
+		}
+		m_cond.notify_one();
+	}
+
+	hackrf_device *m_device;
+	std::vector<int8_t> m_ring; //received, not yet passed on
+	size_t m_head; //oldest queued byte
+	size_t m_fill; //bytes queued, always whole samples
+	uint64_t m_overflows; //transfers dropped
+	bool m_streaming;
+	double m_freq; //last frequency tuned successfully
+	std::map<std::string, double> m_gains;
+	boost::mutex m_mutex;
+	boost::condition_variable m_cond;
+};
+
+typedef boost::shared_ptr<hackrf_source> hackrf_source_sptr;
+
+#endif
@@ -0,0 +1,409 @@
+/*
+	gr-scan - A GNU Radio signal scanner
+	Copyright (C) 2015 Jason A. Donenfeld <Jason@zx2c4.com>. All Rights Reserved.
+	Copyright (C) 2012  Nicholas Tomlinson
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef IQ_RECORDER_HPP
+#define IQ_RECORDER_HPP
+
+/* Raw IQ of every dwell, as SigMF recordings: one pair of files per segment
+ *
+ *   <dir>/iq_dev<D>_<YYYYmmdd_HHMMSS>_<N>.sigmf-data   cf32_le samples, dwell after dwell
+ *   <dir>/iq_dev<D>_<YYYYmmdd_HHMMSS>_<N>.sigmf-meta   JSON: one capture (LO, time, gain)
+ *                                                     and one annotation (extent) per dwell
+ *
+ * Only the samples the sink used are stored, not the settling time after a retune.
+ * The meta file is written when its segment is closed, one capture or annotation
+ * per line, which is all sigmf_source needs to read it back. */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/time.h>
+
+#include <deque>
+#include <string>
+#include <vector>
+
+#include <boost/bind.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread.hpp>
+
+#include <gnuradio/types.h>
+
+/* One dwell inside a recording */
+struct iq_dwell
+{
+	uint64_t sample_start; //in the segment's data file
+	uint64_t sample_count;
+	uint64_t dropped; //samples the disk couldn't keep up with, missing from the data
+	int64_t time_us; //first sample, microseconds since the epoch
+	double lo; //what the source was tuned to
+	double centre; //the dwell's centre (differs from lo for zoomed dwells)
+	double span;
+	double gain;
+};
+
+/* Keeps the sink off the disk: samples are copied into a pool of preallocated,
+ * page aligned blocks, and a thread of our own writes full blocks to a segment
+ * file that was fallocated up front, with O_DIRECT where the filesystem allows it,
+ * so neither the page cache nor block allocation can hold up the sink. When every
+ * block is waiting for the disk, samples are dropped and counted in the dwell's
+ * metadata rather than stalling. */
+class iq_recorder
+{
+public:
+	iq_recorder(const std::string &directory, unsigned int device, double sample_rate, unsigned int segment_mb) :
+		m_directory(directory),
+		m_device(device),
+		m_rate(sample_rate),
+		m_segment_samples(static_cast<uint64_t>(segment_mb > 0 ? segment_mb : 1) * 1024 * 1024 / sizeof(gr_complex)),
+		m_current(NULL),
+		m_fill(0),
+		m_segment(0),
+		m_written(0),
+		m_in_dwell(false),
+		m_dropped_total(0),
+		m_file(-1),
+		m_direct(false),
+		m_file_bytes(0),
+		m_files(0),
+		m_stop(false)
+	{
+		m_dwell.dropped = 0;
+		for (unsigned int b = 0; b < block_count; ++b)
+		{
+			void *block = NULL;
+			if (posix_memalign(&block, alignment, block_bytes) == 0)
+				m_free.push_back(static_cast<char *>(block));
+		}
+	}
+
+	~iq_recorder()
+	{
+		Stop();
+		while (!m_free.empty())
+		{
+			free(m_free.back());
+			m_free.pop_back();
+		}
+	}
+
+	void Start()
+	{
+		m_stop = false;
+		m_thread = boost::thread(boost::bind(&iq_recorder::Run, this));
+	}
+
+	/* Writes out what is queued and closes the segment */
+	void Stop()
+	{
+		{
+			boost::lock_guard<boost::mutex> lock(m_mutex);
+			if (m_current)
+			{
+				QueueBlock();
+				m_current = NULL;
+			}
+			m_stop = true;
+		}
+		m_cond.notify_all();
+		if (m_thread.joinable())
+			m_thread.join();
+	}
+
+	/* Sample thread: count more samples of the current dwell */
+	void Record(const gr_complex *samples, unsigned int count)
+	{
+		if (!m_in_dwell)
+		{
+			if (m_written >= m_segment_samples) //dwells never straddle two files
+				NextSegment();
+			m_in_dwell = true;
+			m_dwell.sample_start = m_written;
+			m_dwell.dropped = 0;
+			timeval tv;
+			gettimeofday(&tv, NULL);
+			m_dwell.time_us = static_cast<int64_t>(tv.tv_sec) * 1000000 + tv.tv_usec;
+		}
+
+		const size_t per_block = block_bytes / sizeof(gr_complex);
+		while (count > 0)
+		{
+			if (!m_current && !NextBlock())
+			{
+				m_dwell.dropped += count;
+				return;
+			}
+			unsigned int chunk = per_block - m_fill < count ? per_block - m_fill : count;
+			memcpy(m_current + m_fill * sizeof(gr_complex), samples, chunk * sizeof(gr_complex));
+			m_fill += chunk;
+			m_written += chunk;
+			samples += chunk;
+			count -= chunk;
+			if (m_fill == per_block)
+			{
+				boost::lock_guard<boost::mutex> lock(m_mutex);
+				QueueBlock();
+				m_current = NULL;
+			}
+		}
+	}
+
+	/* Sample thread: the dwell recorded since the last EndDwell is complete */
+	void EndDwell(double lo, double centre, double span, double gain)
+	{
+		if (!m_in_dwell)
+			return;
+		m_in_dwell = false;
+		m_dwell.sample_count = m_written - m_dwell.sample_start;
+		m_dwell.lo = lo;
+		m_dwell.centre = centre;
+		m_dwell.span = span;
+		m_dwell.gain = gain;
+		if (m_dwell.dropped > 0 && m_dropped_total == 0)
+			fprintf(stderr, "[!] IQ recorder can't keep up, dropping samples (counted in the metadata)\n");
+		m_dropped_total += m_dwell.dropped;
+
+		boost::lock_guard<boost::mutex> lock(m_mutex);
+		m_queue.push_back(item(item::DWELL, m_segment));
+		m_queue.back().dwell = m_dwell;
+		m_cond.notify_all();
+	}
+
+private:
+	static const size_t alignment = 4096; //O_DIRECT wants aligned buffers, offsets and sizes
+	static const size_t block_bytes = 4 << 20;
+	static const unsigned int block_count = 16; //64 MB, ~0.4 s at 20 Msps
+
+	struct item
+	{
+		enum { DATA, DWELL };
+		item(int kind, unsigned int segment) : kind(kind), segment(segment), block(NULL), bytes(0) {}
+		int kind;
+		unsigned int segment;
+		char *block;
+		size_t bytes;
+		iq_dwell dwell;
+	};
+
+	/* Hands m_current to the writer; called with m_mutex held */
+	void QueueBlock()
+	{
+		m_queue.push_back(item(item::DATA, m_segment));
+		m_queue.back().block = m_current;
+		m_queue.back().bytes = m_fill * sizeof(gr_complex);
+		m_fill = 0;
+		m_cond.notify_all();
+	}
+
+	bool NextBlock()
+	{
+		boost::lock_guard<boost::mutex> lock(m_mutex);
+		if (m_free.empty())
+			return false;
+		m_current = m_free.back();
+		m_free.pop_back();
+		m_fill = 0;
+		return true;
+	}
+
+	/* Hands over the partial block (only ever at the end of a segment) and starts a new file */
+	void NextSegment()
+	{
+		boost::lock_guard<boost::mutex> lock(m_mutex);
+		if (m_current)
+		{
+			QueueBlock();
+			m_current = NULL;
+		}
+		++m_segment;
+		m_written = 0;
+	}
+
+	void Run()
+	{
+		unsigned int open_segment = ~0u;
+		boost::unique_lock<boost::mutex> lock(m_mutex);
+		for (;;)
+		{
+			while (m_queue.empty() && !m_stop)
+				m_cond.wait(lock);
+			if (m_queue.empty())
+				break;
+			item it = m_queue.front();
+			m_queue.pop_front();
+			lock.unlock();
+
+			if (it.segment != open_segment)
+			{
+				CloseSegment();
+				OpenSegment();
+				open_segment = it.segment;
+			}
+			if (it.kind == item::DATA)
+				WriteBlock(it.block, it.bytes);
+			else
+				m_dwells.push_back(it.dwell);
+
+			lock.lock();
+			if (it.block)
+				m_free.push_back(it.block);
+		}
+		lock.unlock();
+		CloseSegment();
+	}
+
+	void OpenSegment()
+	{
+		time_t now = time(NULL);
+		struct tm tm;
+		localtime_r(&now, &tm);
+		char stamp[64];
+		strftime(stamp, sizeof(stamp), "%Y%m%d_%H%M%S", &tm);
+		char name[128];
+		snprintf(name, sizeof(name), "/iq_dev%u_%s_%03u", m_device, stamp, m_files++);
+		m_base = m_directory + name;
+
+		std::string data = m_base + ".sigmf-data";
+		m_direct = true;
+		m_file = open(data.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_DIRECT, 0666);
+		if (m_file < 0 && errno == EINVAL) //tmpfs and friends
+		{
+			m_direct = false;
+			m_file = open(data.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0666);
+		}
+		if (m_file < 0)
+		{
+			fprintf(stderr, "[!] can't open IQ recording %s\n", data.c_str());
+			return;
+		}
+		posix_fallocate(m_file, 0, m_segment_samples * sizeof(gr_complex) + block_bytes); //extents now, not while writing
+		m_file_bytes = 0;
+		m_dwells.clear();
+	}
+
+	void WriteBlock(char *block, size_t bytes)
+	{
+		if (m_file < 0 || bytes == 0)
+			return;
+		size_t padded = m_direct ? (bytes + alignment - 1) / alignment * alignment : bytes; //only the last block is short
+		if (padded > bytes)
+			memset(block + bytes, 0, padded - bytes);
+		size_t done = 0;
+		while (done < padded)
+		{
+			ssize_t n = pwrite(m_file, block + done, padded - done, m_file_bytes + done);
+			if (n <= 0)
+			{
+				fprintf(stderr, "[!] IQ recording write failed\n");
+				break;
+			}
+			done += n;
+		}
+		m_file_bytes += bytes;
+	}
+
+	/* Cuts the data file down to what was written and writes the metadata */
+	void CloseSegment()
+	{
+		if (m_file < 0)
+			return;
+		if (ftruncate(m_file, m_file_bytes) != 0)
+			fprintf(stderr, "[!] can't trim IQ recording %s.sigmf-data\n", m_base.c_str());
+		close(m_file);
+		m_file = -1;
+
+		std::string meta = m_base + ".sigmf-meta";
+		FILE *out = fopen(meta.c_str(), "w");
+		if (!out)
+		{
+			fprintf(stderr, "[!] can't write %s\n", meta.c_str());
+			return;
+		}
+		fprintf(out, "{\n  \"global\": {\n");
+		fprintf(out, "    \"core:datatype\": \"cf32_le\",\n");
+		fprintf(out, "    \"core:sample_rate\": %.17g,\n", m_rate);
+		fprintf(out, "    \"core:version\": \"1.0.0\",\n");
+		fprintf(out, "    \"core:recorder\": \"gr-scan\",\n");
+		fprintf(out, "    \"core:description\": \"gr-scan dwells, device %u\",\n", m_device);
+		fprintf(out, "    \"core:extensions\": [{\"name\": \"grscan\", \"version\": \"1.0.0\", \"optional\": true}]\n");
+		fprintf(out, "  },\n  \"captures\": [\n");
+		for (size_t i = 0; i < m_dwells.size(); ++i)
+		{
+			const iq_dwell &d = m_dwells[i];
+			time_t seconds = d.time_us / 1000000;
+			struct tm tm;
+			gmtime_r(&seconds, &tm);
+			char stamp[64];
+			strftime(stamp, sizeof(stamp), "%Y-%m-%dT%H:%M:%S", &tm);
+			fprintf(out, "    {\"core:sample_start\": %llu, \"core:frequency\": %.17g, \"core:datetime\": \"%s.%06dZ\", \"grscan:gain\": %g}%s\n",
+				static_cast<unsigned long long>(d.sample_start), d.lo, stamp, static_cast<int>(d.time_us % 1000000), d.gain,
+				i + 1 < m_dwells.size() ? "," : "");
+		}
+		fprintf(out, "  ],\n  \"annotations\": [\n");
+		for (size_t i = 0; i < m_dwells.size(); ++i)
+		{
+			const iq_dwell &d = m_dwells[i];
+			fprintf(out, "    {\"core:sample_start\": %llu, \"core:sample_count\": %llu, \"core:freq_lower_edge\": %.17g, \"core:freq_upper_edge\": %.17g, "
+				"\"core:label\": \"dwell\", \"grscan:centre\": %.17g, \"grscan:dropped\": %llu}%s\n",
+				static_cast<unsigned long long>(d.sample_start), static_cast<unsigned long long>(d.sample_count),
+				d.centre - d.span / 2.0, d.centre + d.span / 2.0, d.centre, static_cast<unsigned long long>(d.dropped),
+				i + 1 < m_dwells.size() ? "," : "");
+		}
+		fprintf(out, "  ]\n}\n");
+		fclose(out);
+	}
+
+	std::string m_directory;
+	unsigned int m_device;
+	double m_rate;
+	uint64_t m_segment_samples; //a new file is started at the first dwell past this
+
+	/* sample thread */
+	char *m_current; //block being filled, NULL if none
+	size_t m_fill; //samples in m_current
+	unsigned int m_segment; //number of the segment being filled
+	uint64_t m_written; //samples stored in this segment
+	bool m_in_dwell;
+	iq_dwell m_dwell;
+	uint64_t m_dropped_total;
+
+	/* writer thread */
+	int m_file;
+	bool m_direct; //m_file was opened with O_DIRECT
+	uint64_t m_file_bytes;
+	unsigned int m_files; //segments opened so far, for unique names
+	std::string m_base; //path of the segment without extension
+	std::vector<iq_dwell> m_dwells; //in the open segment
+
+	bool m_stop;
+	std::vector<char *> m_free; //blocks ready for the sample thread
+	std::deque<item> m_queue; //blocks and dwells for the writer, in order
+	boost::mutex m_mutex;
+	boost::condition_variable m_cond;
+	boost::thread m_thread;
+};
+
+typedef boost::shared_ptr<iq_recorder> iq_recorder_sptr;
+
+#endif
@@ -0,0 +1,265 @@
+/*
+	gr-scan - A GNU Radio signal scanner
+	Copyright (C) 2015 Jason A. Donenfeld <Jason@zx2c4.com>. All Rights Reserved.
+	Copyright (C) 2012  Nicholas Tomlinson
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* gr-scan-log2txt - regenerates the old logs/signal_HH_MM_SS_<f1>_<f2>.txt files
+ * from binary dwell log segments, and the signals gr-scan -D found into signals.txt.
+ *
+ * usage: gr-scan-log2txt [-a] [-d DEV] [-o DIR] [-f MHZ] [-F MHZ] [-t SEC] [-T SEC] SEGMENT.bin...
+ *   -a       write every dwell (default: only when the centre moved >= 1 MHz, like gr-scan used to);
+ *            signals are always written, one "Found signal" line each
+ *   -d DEV   only dwells taken by device DEV (counted from 0 in the order of gr-scan's -d options)
+ *   -o DIR   output directory (default: .)
+ *   -f/-F    only dwells centred between these frequencies in MHz
+ *   -t/-T    only dwells between these times, in seconds since the scanner started
+ *
+ * The .idx file next to each segment is used to find matching dwells without
+ * reading the whole segment; without it the segment is read front to back. */
+
+#define DWELL_LOG_READER_ONLY
+#include "dwell_log.hpp"
+
+#include <stdlib.h>
+#include <getopt.h>
+
+#include <map>
+
+struct filter
+{
+	double min_freq, max_freq;
+	double min_time, max_time;
+	bool all;
+	int device; //-1 for all
+	std::string directory;
+	std::map<uint32_t, double> last_log_out; //per device, so interleaved devices don't hide each other
+	FILE *signals; //signals.txt, opened at the first event record
+};
+
+static bool Matches(const filter &f, const dwell_log_header &header, int64_t time_us, double centre)
+{
+	double t = (time_us - header.session_start_us) / 1000000.0;
+	return centre >= f.min_freq && centre <= f.max_freq && t >= f.min_time && t <= f.max_time;
+}
+
+/* Appends the signals of one event record to signals.txt, as scanner_sink prints them */
+static bool WriteSignals(filter &f, const dwell_log_header &header, const dwell_log_record &record, const std::vector<char> &events)
+{
+	if (!f.signals)
+	{
+		std::string path = f.directory + "/signals.txt";
+		f.signals = fopen(path.c_str(), "a");
+		if (!f.signals)
+		{
+			perror(path.c_str());
+			return false;
+		}
+	}
+	unsigned int t = (record.time_us - header.session_start_us) / 1000000;
+	for (unsigned int e = 0; e < record.bins; ++e)
+	{
+		dwell_log_event event;
+		memcpy(&event, &events[e * sizeof(event)], sizeof(event));
+		fprintf(f.signals, "[+] %02u:%02u:%02u: [dev %u] Found signal: at %f MHz of width %f kHz, peak power %f dB (SNR %f dB)\n",
+			t / 3600, (t % 3600) / 60, t % 60, record.device, event.centre/1000000.0, event.bandwidth/1000.0, event.peak, event.snr);
+	}
+	return true;
+}
+
+/* Value i of a record's bins, in dB */
+static float BinValue(const dwell_log_record &record, const std::vector<char> &bins, unsigned int i)
+{
+	if (record.format == DWELL_BINS_Q16)
+		return reinterpret_cast<const int16_t *>(&bins[0])[i] / 100.0f;
+	return reinterpret_cast<const float *>(&bins[0])[i];
+}
+
+/* Writes one dwell in the format of scanner_sink::PrintSignals before the binary log,
+ * with max-hold and min-hold columns after the level if the dwell has them */
+static bool WriteText(filter &f, const dwell_log_header &header, const dwell_log_record &record, const std::vector<char> &bins)
+{
+	if (f.device >= 0 && record.device != static_cast<uint32_t>(f.device))
+		return true;
+	if (record.format == DWELL_EVENTS)
+		return WriteSignals(f, header, record, bins);
+	double &last_log_out = f.last_log_out[record.device];
+	if (!f.all && fabs(record.centre - last_log_out) < 1000000.0)
+		return true;
+	last_log_out = record.centre;
+
+	unsigned int t = (record.time_us - header.session_start_us) / 1000000;
+	unsigned int hours = t / 3600;
+	unsigned int minutes = (t % 3600) / 60;
+	unsigned int seconds = t % 60;
+	char logfn[1024];
+	snprintf(logfn, sizeof(logfn), "%s/signal_%02u_%02u_%02u_%f_%f.txt", f.directory.c_str(), hours, minutes, seconds,
+		(record.centre - record.span/2.0)/1000000.0, (record.centre + record.span/2.0)/1000000.0);
+	FILE *out = fopen(logfn, "w");
+	if (!out)
+	{
+		perror(logfn);
+		return false;
+	}
+	double samplewidth = record.span/(double)record.bins;
+	for (unsigned int i = 0; i < record.bins; ++i)
+	{
+		double freq = record.centre + i * samplewidth - record.span / 2.0;
+		if (record.flags & DWELL_FLAG_HOLD) //mean, max-hold and min-hold
+			fprintf(out, "%g %g %g %g\n", freq, BinValue(record, bins, i), BinValue(record, bins, record.bins + i),
+				BinValue(record, bins, 2 * record.bins + i));
+		else
+			fprintf(out, "%g %g\n", freq, BinValue(record, bins, i));
+	}
+	fclose(out);
+	return true;
+}
+
+/* Reads the record at the current position of in; false at the end or on a torn record */
+static bool ReadRecord(FILE *in, dwell_log_record &record, std::vector<char> &bins)
+{
+	if (fread(&record, sizeof(record), 1, in) != 1 || record.magic != DWELL_RECORD_MAGIC)
+		return false;
+	bins.resize(dwell_log_payload_size(record));
+	return bins.empty() || fread(&bins[0], bins.size(), 1, in) == 1;
+}
+
+static int ConvertSegment(filter &f, const std::string &path)
+{
+	FILE *in = fopen(path.c_str(), "rb");
+	if (!in)
+	{
+		perror(path.c_str());
+		return 1;
+	}
+	dwell_log_header header;
+	if (fread(&header, sizeof(header), 1, in) != 1 || memcmp(header.magic, DWELL_LOG_MAGIC, sizeof(header.magic)) != 0)
+	{
+		fprintf(stderr, "%s: not a gr-scan dwell log\n", path.c_str());
+		fclose(in);
+		return 1;
+	}
+	if (header.version != DWELL_LOG_VERSION) //the record layout changed with every version
+	{
+		fprintf(stderr, "%s: dwell log version %u, this gr-scan-log2txt reads version %u\n", path.c_str(), header.version, DWELL_LOG_VERSION);
+		fclose(in);
+		return 1;
+	}
+
+	std::string index_path = path;
+	if (index_path.size() > 4 && index_path.compare(index_path.size() - 4, 4, ".bin") == 0)
+		index_path.replace(index_path.size() - 4, 4, ".idx");
+	FILE *index = index_path != path ? fopen(index_path.c_str(), "rb") : NULL;
+	dwell_log_header index_header;
+	if (index && (fread(&index_header, sizeof(index_header), 1, index) != 1 ||
+		memcmp(index_header.magic, DWELL_INDEX_MAGIC, sizeof(index_header.magic)) != 0 ||
+		index_header.session_start_us != header.session_start_us)) //not from the run that wrote the segment
+	{
+		fclose(index);
+		index = NULL;
+	}
+
+	dwell_log_record record;
+	std::vector<char> bins;
+	int ret = 0;
+	if (index)
+	{
+		dwell_log_index entry;
+		while (fread(&entry, sizeof(entry), 1, index) == 1)
+		{
+			if (!Matches(f, header, entry.time_us, entry.centre))
+				continue;
+			if (fseeko(in, entry.offset, SEEK_SET) != 0 || !ReadRecord(in, record, bins))
+				break; //index points past a torn record at the end
+			if (!WriteText(f, header, record, bins))
+			{
+				ret = 1;
+				break;
+			}
+		}
+		fclose(index);
+	}
+	else
+	{
+		while (ReadRecord(in, record, bins))
+		{
+			if (Matches(f, header, record.time_us, record.centre) && !WriteText(f, header, record, bins))
+			{
+				ret = 1;
+				break;
+			}
+		}
+	}
+	fclose(in);
+	return ret;
+}
+
+int main(int argc, char **argv)
+{
+	filter f;
+	f.min_freq = 0.0;
+	f.max_freq = 1e300;
+	f.min_time = 0.0;
+	f.max_time = 1e300;
+	f.all = false;
+	f.device = -1;
+	f.directory = ".";
+	f.signals = NULL;
+
+	int opt;
+	while ((opt = getopt(argc, argv, "ad:o:f:F:t:T:")) != -1)
+	{
+		switch (opt)
+		{
+		case 'a':
+			f.all = true;
+			break;
+		case 'd':
+			f.device = atoi(optarg);
+			break;
+		case 'o':
+			f.directory = optarg;
+			break;
+		case 'f':
+			f.min_freq = atof(optarg) * 1000000.0; //MHz
+			break;
+		case 'F':
+			f.max_freq = atof(optarg) * 1000000.0; //MHz
+			break;
+		case 't':
+			f.min_time = atof(optarg);
+			break;
+		case 'T':
+			f.max_time = atof(optarg);
+			break;
+		default:
+			fprintf(stderr, "usage: %s [-a] [-d DEV] [-o DIR] [-f MHZ] [-F MHZ] [-t SEC] [-T SEC] SEGMENT.bin...\n", argv[0]);
+			return 1;
+		}
+	}
+	if (optind >= argc)
+	{
+		fprintf(stderr, "usage: %s [-a] [-d DEV] [-o DIR] [-f MHZ] [-F MHZ] [-t SEC] [-T SEC] SEGMENT.bin...\n", argv[0]);
+		return 1;
+	}
+
+	int ret = 0;
+	for (int i = optind; i < argc; ++i)
+		ret |= ConvertSegment(f, argv[i]);
+	if (f.signals)
+		fclose(f.signals);
+	return ret;
+}
@@ -27,19 +27,7 @@ int main(int argc, char **argv)
 {
 	Arguments arguments(argc, argv);
 
-	TopBlock top_block(
-		arguments.get_start_freq(),
-		arguments.get_end_freq(),
-		arguments.get_sample_rate(),
-		arguments.get_fft_width(),
-		arguments.get_step(),
-		arguments.get_avg_size(),
-		arguments.get_gain_a(),
-		arguments.get_gain_m(),
-		arguments.get_gain_if(),
-		arguments.get_gain_total(),
-		arguments.get_use_AGC()
-	);	
+	TopBlock top_block(arguments.get_devices(), arguments.get_segments(), arguments.get_options());
 	top_block.run();
 	return 0; //actually, we never get here because of the rude way in which we end the scan
 }
@@ -0,0 +1,328 @@
+/*
+	gr-scan - A GNU Radio signal scanner
+	Copyright (C) 2015 Jason A. Donenfeld <Jason@zx2c4.com>. All Rights Reserved.
+	Copyright (C) 2012  Nicholas Tomlinson
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef SCAN_CONTROL_HPP
+#define SCAN_CONTROL_HPP
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <cstdio>
+#include <stdint.h>
+#include <vector>
+
+#include <boost/bind.hpp>
+#include <boost/function.hpp>
+#include <boost/thread.hpp>
+
+#include "scan_source.hpp"
+#include "sweep_plan.hpp"
+#include "scan_stats.hpp"
+#include "gain_memory.hpp"
+
+/* Owns the blocking calls into the source (set_center_freq, set_gain) and runs
+ * them on its own thread, so the sink keeps draining samples while the hardware
+ * retunes instead of letting them pile up in the USB buffers. */
+class tuning_control
+{
+public:
+	enum { RETUNE_IDLE, RETUNE_PENDING, RETUNE_DONE };
+
+	tuning_control(scan_source_sptr source, sweep_plan_sptr plan, const sweep_dwell &start, scan_stats_sptr stats, unsigned int device, gain_memory_sptr gains) :
+		m_source(source),
+		m_plan(plan), //decides where each dwell goes
+		m_dwell(start), //TopBlock tunes the source here before the scan starts
+		m_actual(start.lo),
+		m_recalled(false),
+		m_recalled_rf(0),
+		m_recalled_if(0),
+		m_retune_state(RETUNE_IDLE),
+		m_gain_pending(false),
+		m_gain_rf(0),
+		m_gain_if(0),
+		m_gains(gains), //AGC gains to start each dwell with, NULL without AGC
+		m_stats(stats), //retune and set_gain latency
+		m_device(device),
+		m_stop(false)
+	{
+	}
+
+	~tuning_control()
+	{
+		Stop();
+	}
+
+	void Start()
+	{
+		m_stop = false;
+		m_thread = boost::thread(boost::bind(&tuning_control::Run, this));
+	}
+
+	void Stop()
+	{
+		{
+			boost::lock_guard<boost::mutex> lock(m_mutex);
+			m_stop = true;
+		}
+		m_cond.notify_all();
+		if (m_thread.joinable())
+			m_thread.join();
+	}
+
+	/* Asks the sweep plan for the next frequency; PollRetune reports when we are there */
+	void RequestRetune()
+	{
+		{
+			boost::lock_guard<boost::mutex> lock(m_mutex);
+			m_retune_state = RETUNE_PENDING;
+		}
+		m_cond.notify_all();
+	}
+
+	/* Returns RETUNE_PENDING while the source is still moving. RETUNE_DONE is returned
+	 * once per retune, together with the dwell we moved to and the LO frequency we got.
+	 * recalled says whether the gain memory set rf/if_gain before the retune finished. */
+	int PollRetune(sweep_dwell &dwell, double &actual, bool &recalled, double &rf, double &if_gain)
+	{
+		boost::lock_guard<boost::mutex> lock(m_mutex);
+		int state = m_retune_state;
+		if (state == RETUNE_DONE)
+		{
+			dwell = m_dwell;
+			actual = m_actual;
+			recalled = m_recalled;
+			rf = m_recalled_rf;
+			if_gain = m_recalled_if;
+			m_retune_state = RETUNE_IDLE;
+		}
+		return state;
+	}
+
+	/* Queues a gain change; if the thread is busy only the latest request is applied */
+	void RequestGain(double rf, double if_gain)
+	{
+		{
+			boost::lock_guard<boost::mutex> lock(m_mutex);
+			m_gain_rf = rf;
+			m_gain_if = if_gain;
+			m_gain_pending = true;
+		}
+		m_cond.notify_all();
+	}
+
+private:
+	void Run()
+	{
+		boost::unique_lock<boost::mutex> lock(m_mutex);
+		while (!m_stop)
+		{
+			if (m_gain_pending) //gain first, so the new frequency starts with it
+			{
+				double rf = m_gain_rf, if_gain = m_gain_if;
+				m_gain_pending = false;
+				lock.unlock();
+				uint64_t begin = scan_stats_now();
+				m_source->set_gain(rf, "RF");
+				m_source->set_gain(if_gain, "IF");
+				m_stats->Record(m_device, scan_stats::PHASE_AGC, scan_stats_now() - begin);
+				lock.lock();
+				continue;
+			}
+			if (m_retune_state == RETUNE_PENDING)
+			{
+				sweep_dwell dwell;
+				double actual, rf = 0, if_gain = 0;
+				lock.unlock();
+				uint64_t begin = scan_stats_now();
+				NextFrequency(dwell, actual);
+				m_stats->Record(m_device, scan_stats::PHASE_RETUNE, scan_stats_now() - begin);
+				bool recalled = m_gains && m_gains->Lookup(m_device, dwell.lo, rf, if_gain);
+				if (recalled) //before RETUNE_DONE, so the settle time after it covers the gain change too
+				{
+					begin = scan_stats_now();
+					m_source->set_gain(rf, "RF");
+					m_source->set_gain(if_gain, "IF");
+					m_stats->Record(m_device, scan_stats::PHASE_AGC, scan_stats_now() - begin);
+				}
+				lock.lock();
+				m_dwell = dwell;
+				m_actual = actual;
+				m_recalled = recalled;
+				m_recalled_rf = rf;
+				m_recalled_if = if_gain;
+				m_retune_state = RETUNE_DONE;
+				continue;
+			}
+			m_cond.wait(lock);
+		}
+	}
+
+	void NextFrequency(sweep_dwell &dwell, double &actual)
+	{
+		for (;;) { //keep moving to the next frequency until we get to one we can listen on (copes with holes in the tunable range)
+			dwell = m_plan->Next(sweep_plan_now()); //calculate the frequency we should change to
+			actual = m_source->set_center_freq(dwell.lo); //change frequency
+			if (fabs(dwell.lo - actual) < 100.0) //success
+				break; //so stop changing frequency
+		}
+	}
+
+	scan_source_sptr m_source;
+	sweep_plan_sptr m_plan;
+	sweep_dwell m_dwell; //dwell we are at (or moving away from)
+	double m_actual; //what the source reported for m_dwell.lo
+	bool m_recalled; //the gain memory knew m_dwell.lo and set these
+	double m_recalled_rf;
+	double m_recalled_if;
+	int m_retune_state;
+	bool m_gain_pending;
+	double m_gain_rf;
+	double m_gain_if;
+	gain_memory_sptr m_gains;
+	scan_stats_sptr m_stats;
+	unsigned int m_device;
+	bool m_stop;
+	boost::mutex m_mutex;
+	boost::condition_variable m_cond;
+	boost::thread m_thread;
+};
+
+/* One finished dwell as handed from the sink to the finalizer thread */
+struct dwell_record
+{
+	std::vector<float> buffer; //sum of count power spectra, in FFT order
+	std::vector<float> squares; //bin_moments of the same spectra, empty unless kept
+	std::vector<float> crossings;
+	std::vector<float> max; //bin_hold of the same spectra, empty unless kept
+	std::vector<float> min;
+	std::vector<uint16_t> persistence; //persistence histogram of the same spectra, empty unless kept
+	double centre; //centre frequency of the published bins
+	double lo; //frequency the source was tuned to
+	double span; //bandwidth the buffer covers
+	unsigned int first; //published bins of the fftshifted spectrum
+	unsigned int bins;
+	double gain; //total gain in dB the spectra were taken with
+	unsigned int count; //number of spectra in buffer
+};
+
+/* Double-buffered hand-off of the dwell accumulator: the sink swaps its full
+ * accumulator for the spare one and carries on, the worker thread turns the full
+ * one into published spectra and zeroes it for the next swap. */
+class dwell_finalizer
+{
+public:
+	typedef boost::function<void (dwell_record &)> callback;
+
+	dwell_finalizer(unsigned int vector_length, bool moments, bool hold, unsigned int persistence_levels, callback finish) :
+		m_finish(finish),
+		m_busy(false),
+		m_stop(false)
+	{
+		m_record.buffer.resize(vector_length, 0.0f);
+		m_record.squares.resize(moments ? vector_length : 0, 0.0f);
+		m_record.crossings.resize(moments ? vector_length : 0, 0.0f);
+		m_record.max.resize(hold ? vector_length : 0, 0.0f);
+		m_record.min.resize(hold ? vector_length : 0, FLT_MAX);
+		m_record.persistence.resize(static_cast<size_t>(vector_length) * persistence_levels, 0);
+	}
+
+	~dwell_finalizer()
+	{
+		Stop();
+	}
+
+	void Start()
+	{
+		m_stop = false;
+		m_thread = boost::thread(boost::bind(&dwell_finalizer::Run, this));
+	}
+
+	/* Finishes the dwell that is in flight, then stops the thread */
+	void Stop()
+	{
+		{
+			boost::lock_guard<boost::mutex> lock(m_mutex);
+			m_stop = true;
+		}
+		m_cond.notify_all();
+		if (m_thread.joinable())
+			m_thread.join();
+	}
+
+	/* Takes the full accumulator (and the squares, crossings, holds and persistence
+	 * that go with it) and leaves reset ones in their place. Only blocks if the
+	 * previous dwell is still being written out. */
+	void Submit(std::vector<float> &accumulator, std::vector<float> &squares, std::vector<float> &crossings, std::vector<float> &max,
+		std::vector<float> &min, std::vector<uint16_t> &persistence, double centre, double lo, double span, unsigned int first, unsigned int bins, double gain, unsigned int count)
+	{
+		boost::unique_lock<boost::mutex> lock(m_mutex);
+		while (m_busy)
+			m_cond.wait(lock);
+		m_record.buffer.swap(accumulator);
+		m_record.squares.swap(squares);
+		m_record.crossings.swap(crossings);
+		m_record.max.swap(max);
+		m_record.min.swap(min);
+		m_record.persistence.swap(persistence);
+		m_record.centre = centre;
+		m_record.lo = lo;
+		m_record.span = span;
+		m_record.first = first;
+		m_record.bins = bins;
+		m_record.gain = gain;
+		m_record.count = count;
+		m_busy = true;
+		lock.unlock();
+		m_cond.notify_all();
+	}
+
+private:
+	void Run()
+	{
+		boost::unique_lock<boost::mutex> lock(m_mutex);
+		for (;;)
+		{
+			while (!m_busy && !m_stop)
+				m_cond.wait(lock);
+			if (!m_busy)
+				break;
+			lock.unlock();
+			m_finish(m_record);
+			std::fill(m_record.buffer.begin(), m_record.buffer.end(), 0.0f);
+			std::fill(m_record.squares.begin(), m_record.squares.end(), 0.0f);
+			std::fill(m_record.crossings.begin(), m_record.crossings.end(), 0.0f);
+			std::fill(m_record.max.begin(), m_record.max.end(), 0.0f); //powers are never negative
+			std::fill(m_record.min.begin(), m_record.min.end(), FLT_MAX);
+			std::fill(m_record.persistence.begin(), m_record.persistence.end(), 0);
+			lock.lock();
+			m_busy = false;
+			m_cond.notify_all();
+		}
+	}
+
+	callback m_finish;
+	dwell_record m_record; //the spare accumulator, or the dwell being written out
+	bool m_busy; //m_record holds a dwell the worker hasn't finished with
+	bool m_stop;
+	boost::mutex m_mutex;
+	boost::condition_variable m_cond;
+	boost::thread m_thread;
+};
+
+#endif
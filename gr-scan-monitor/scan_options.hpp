@@ -0,0 +1,90 @@
+/*
+	gr-scan - A GNU Radio signal scanner
+	Copyright (C) 2015 Jason A. Donenfeld <Jason@zx2c4.com>. All Rights Reserved.
+	Copyright (C) 2012  Nicholas Tomlinson
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef SCAN_OPTIONS_HPP
+#define SCAN_OPTIONS_HPP
+
+#include <string>
+#include <vector>
+
+/* Everything the command line sets about how each device scans, handed to TopBlock
+ * and on to every scanner_sink in one piece. Starts out with gr-scan's defaults, so
+ * Arguments and the benchmarks only touch the fields they change. */
+struct scan_options
+{
+	scan_options() :
+		sample_rate(2000000.0),
+		fft_width(1000.0),
+		avg_size(1000),
+		gain_a(0.0),
+		gain_m(0.0),
+		gain_if(0.0),
+		gain_total(0.0),
+		use_AGC(1),
+		overlap(0.0),
+		pfb(0),
+		settle_time(0.005),
+		log_segment_minutes(10),
+		quantize_log(false),
+		min_avg_size(32),
+		tolerance(0.0),
+		stats_path("logs/timing.txt"),
+		stats_interval(10),
+		record_segment_mb(1024),
+		fft_wisdom_path("logs/fftw.wisdom"),
+		fft_threads(0),
+		detect_threshold(0.0f),
+		events_only(false),
+		duty_level(0.0f),
+		hold(false),
+		persistence_step(0.0f)
+	{
+	}
+
+	double sample_rate;
+	double fft_width;
+	unsigned int avg_size;
+	double gain_a;
+	double gain_m;
+	double gain_if;
+	double gain_total; //overrides the individual gains when non-zero
+	int use_AGC;
+	double overlap; //percent
+	unsigned int pfb; //filterbank oversampling, 0 for a windowed FFT
+	double settle_time; //seconds
+	unsigned int log_segment_minutes;
+	bool quantize_log;
+	unsigned int min_avg_size;
+	double tolerance; //dB, 0 for a fixed dwell of avg_size
+	std::string stats_path; //empty for none
+	unsigned int stats_interval;
+	std::string record_dir; //empty for none
+	unsigned int record_segment_mb;
+	std::string gain_memory_path; //empty for none, -H opts in
+	std::vector<double> resolutions; //Hz
+	std::string fft_wisdom_path; //empty for none
+	unsigned int fft_threads; //per device, 0 for automatic
+	float detect_threshold; //dB above the noise floor, 0 for no detection
+	bool events_only;
+	float duty_level; //dB above the noise that counts towards the duty cycle, 0 for no per-bin statistics
+	bool hold;
+	float persistence_step; //dB per persistence level, 0 for no persistence histogram
+};
+
+#endif
@@ -0,0 +1,95 @@
+/*
+	gr-scan - A GNU Radio signal scanner
+	Copyright (C) 2015 Jason A. Donenfeld <Jason@zx2c4.com>. All Rights Reserved.
+	Copyright (C) 2012  Nicholas Tomlinson
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef SCAN_SOURCE_HPP
+#define SCAN_SOURCE_HPP
+
+#include <string>
+
+#include <boost/shared_ptr.hpp>
+
+#include <gnuradio/basic_block.h>
+#include <gnuradio/blocks/file_source.h>
+
+/* What the scanner needs from a receiver: a block producing gr_complex samples
+ * and the two controls the tuning thread uses. osmosdr hardware, the synthetic
+ * generator and IQ file replay all sit behind this. */
+class scan_source
+{
+public:
+	virtual ~scan_source()
+	{
+	}
+
+	virtual gr::basic_block_sptr block() = 0;
+	virtual void set_min_output_buffer(long items) = 0; //before the block is connected
+	virtual double set_center_freq(double freq) = 0; //returns the frequency actually tuned
+	virtual double set_gain(double gain) = 0; //overall, the source spreads it over its stages
+	virtual double set_gain(double gain, const std::string &name) = 0;
+	virtual double get_gain(const std::string &name) = 0;
+};
+
+typedef boost::shared_ptr<scan_source> scan_source_sptr;
+
+/* Any block with osmosdr's tuning methods (osmosdr::source, synthetic_source) */
+template <class T>
+class block_scan_source : public scan_source
+{
+public:
+	block_scan_source(boost::shared_ptr<T> source) :
+		m_source(source)
+	{
+	}
+
+	gr::basic_block_sptr block() { return m_source; }
+	void set_min_output_buffer(long items) { m_source->set_min_output_buffer(items); }
+	double set_center_freq(double freq) { return m_source->set_center_freq(freq); }
+	double set_gain(double gain) { return m_source->set_gain(gain); }
+	double set_gain(double gain, const std::string &name) { return m_source->set_gain(gain, name); }
+	double get_gain(const std::string &name) { return m_source->get_gain(name); }
+
+	boost::shared_ptr<T> source() const { return m_source; }
+
+private:
+	boost::shared_ptr<T> m_source;
+};
+
+/* Replays a file of raw gr_complex samples in a loop, as fast as the sink takes
+ * them. There is nothing to tune: every dwell sees the same recording, which is
+ * what a benchmark of the processing wants. */
+class replay_scan_source : public scan_source
+{
+public:
+	replay_scan_source(const std::string &path) :
+		m_file(gr::blocks::file_source::make(sizeof(gr_complex), path.c_str(), true))
+	{
+	}
+
+	gr::basic_block_sptr block() { return m_file; }
+	void set_min_output_buffer(long items) { m_file->set_min_output_buffer(items); }
+	double set_center_freq(double freq) { return freq; }
+	double set_gain(double gain) { return 0.0; }
+	double set_gain(double gain, const std::string &name) { return 0.0; }
+	double get_gain(const std::string &name) { return 0.0; }
+
+private:
+	gr::blocks::file_source::sptr m_file;
+};
+
+#endif
@@ -0,0 +1,300 @@
+/*
+	gr-scan - A GNU Radio signal scanner
+	Copyright (C) 2015 Jason A. Donenfeld <Jason@zx2c4.com>. All Rights Reserved.
+	Copyright (C) 2012  Nicholas Tomlinson
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef SCAN_STATS_HPP
+#define SCAN_STATS_HPP
+
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <string>
+#include <vector>
+
+#include <boost/bind.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread.hpp>
+
+static inline uint64_t scan_stats_now()
+{
+	timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return static_cast<uint64_t>(ts.tv_sec) * 1000000000ULL + ts.tv_nsec;
+}
+
+/* Log-linear histogram of nanosecond durations, the HdrHistogram layout: exact
+ * below 64 ns, then 32 buckets per power of two, so any recorded value is
+ * reported to within about 3%. Fixed size, recording is a shift and an add. */
+class latency_histogram
+{
+public:
+	latency_histogram() :
+		m_buckets(bucket_count, 0),
+		m_count(0),
+		m_sum(0),
+		m_max(0)
+	{
+	}
+
+	void Record(uint64_t ns)
+	{
+		++m_buckets[Index(ns)];
+		++m_count;
+		m_sum += ns;
+		if (ns > m_max)
+			m_max = ns;
+	}
+
+	uint64_t count() const { return m_count; }
+	uint64_t max() const { return m_max; }
+	double mean() const { return m_count ? static_cast<double>(m_sum) / m_count : 0.0; }
+
+	/* Smallest value at least fraction of the recorded values are no larger than,
+	 * rounded up to the end of its bucket (but never past the maximum) */
+	uint64_t Percentile(double fraction) const
+	{
+		if (m_count == 0)
+			return 0;
+		uint64_t rank = static_cast<uint64_t>(fraction * m_count + 0.5);
+		if (rank < 1)
+			rank = 1;
+		uint64_t seen = 0;
+		for (unsigned int i = 0; i < bucket_count; ++i)
+		{
+			seen += m_buckets[i];
+			if (seen >= rank)
+			{
+				uint64_t top = Highest(i);
+				return top < m_max ? top : m_max;
+			}
+		}
+		return m_max;
+	}
+
+private:
+	static const unsigned int linear = 64; //exact up to here
+	static const unsigned int sub_buckets = 32; //per power of two above that
+	static const unsigned int bucket_count = linear + 58 * sub_buckets;
+
+	static unsigned int Index(uint64_t ns)
+	{
+		if (ns < linear)
+			return ns;
+		unsigned int shift = 63 - __builtin_clzll(ns) - 5; //ns >> shift is in [32, 64)
+		return linear + (shift - 1) * sub_buckets + static_cast<unsigned int>(ns >> shift) - sub_buckets;
+	}
+
+	static uint64_t Highest(unsigned int index)
+	{
+		if (index < linear)
+			return index;
+		unsigned int shift = (index - linear) / sub_buckets + 1;
+		uint64_t sub = (index - linear) % sub_buckets + sub_buckets;
+		return ((sub + 1) << shift) - 1;
+	}
+
+	std::vector<uint64_t> m_buckets;
+	uint64_t m_count;
+	uint64_t m_sum;
+	uint64_t m_max;
+};
+
+/* Where the time of every dwell goes, per device. The sink, its tuning thread and
+ * its finalizer record phases as they finish; a thread of our own rewrites the
+ * stats file every interval seconds and whenever the process gets SIGUSR1.
+ *
+ *   retune   set_center_freq, until the source reports the new frequency
+ *   settle   after the retune, samples dropped for PLL settling (or the rx_freq tag)
+ *   wait     capturing the dwell, minus the time spent averaging: waiting on samples
+ *   average  windows, FFTs and accumulation for the dwell
+ *   publish  PrintSignals: stderr, dwell log queue and shared memory
+ *   agc      set_gain calls made by the AGC or the gain memory
+ *   converge first usable sample to the AGC's last gain step in the dwell, in
+ *            sample time (what it costs at the device's rate), 0 if it didn't step
+ *   dwell    retune done to dwell submitted (settle + wait + average) */
+class scan_stats
+{
+public:
+	enum { PHASE_RETUNE, PHASE_SETTLE, PHASE_WAIT, PHASE_AVERAGE, PHASE_PUBLISH, PHASE_AGC, PHASE_CONVERGE, PHASE_DWELL, PHASE_COUNT };
+
+	scan_stats(const std::string &path, unsigned int interval, unsigned int devices) :
+		m_path(path),
+		m_interval(interval),
+		m_histograms(devices * PHASE_COUNT),
+		m_start(scan_stats_now()),
+		m_users(0),
+		m_stop(false)
+	{
+	}
+
+	~scan_stats()
+	{
+		Join();
+	}
+
+	/* Every sink starts and stops us; the writer runs while any sink does */
+	void Start()
+	{
+		{
+			boost::lock_guard<boost::mutex> lock(m_mutex);
+			if (m_users++ > 0 || m_path.empty())
+				return;
+			m_stop = false;
+		}
+		struct sigaction action;
+		memset(&action, 0, sizeof(action));
+		action.sa_handler = OnSignal;
+		sigemptyset(&action.sa_mask);
+		action.sa_flags = SA_RESTART;
+		sigaction(SIGUSR1, &action, NULL);
+
+		m_thread = boost::thread(boost::bind(&scan_stats::Run, this));
+		printf("[*] timing stats in %s", m_path.c_str());
+		if (m_interval > 0)
+			printf(" every %u s", m_interval);
+		printf(" and on kill -USR1 %d\n", static_cast<int>(getpid()));
+	}
+
+	/* The last sink to stop has the stats written one last time */
+	void Stop()
+	{
+		{
+			boost::lock_guard<boost::mutex> lock(m_mutex);
+			if (m_users == 0 || --m_users > 0)
+				return;
+		}
+		Join();
+	}
+
+	void Record(unsigned int device, unsigned int phase, uint64_t ns)
+	{
+		boost::lock_guard<boost::mutex> lock(m_mutex);
+		m_histograms[device * PHASE_COUNT + phase].Record(ns);
+	}
+
+	/* How many times device has been through phase */
+	uint64_t Count(unsigned int device, unsigned int phase)
+	{
+		boost::lock_guard<boost::mutex> lock(m_mutex);
+		return m_histograms[device * PHASE_COUNT + phase].count();
+	}
+
+	/* Total ns device has spent in phase */
+	double Total(unsigned int device, unsigned int phase)
+	{
+		boost::lock_guard<boost::mutex> lock(m_mutex);
+		const latency_histogram &h = m_histograms[device * PHASE_COUNT + phase];
+		return h.mean() * h.count();
+	}
+
+private:
+	/* Set by SIGUSR1; a function-local static so the header defines no object of its own */
+	static volatile sig_atomic_t &DumpRequested()
+	{
+		static volatile sig_atomic_t requested = 0; //constant-initialized, safe to touch from the handler
+		return requested;
+	}
+
+	static void OnSignal(int)
+	{
+		DumpRequested() = 1;
+	}
+
+	void Join()
+	{
+		{
+			boost::lock_guard<boost::mutex> lock(m_mutex);
+			m_stop = true;
+		}
+		m_cond.notify_all();
+		if (m_thread.joinable())
+			m_thread.join();
+	}
+
+	void Run()
+	{
+		uint64_t next = scan_stats_now() + m_interval * 1000000000ULL;
+		boost::unique_lock<boost::mutex> lock(m_mutex);
+		for (;;)
+		{
+			m_cond.timed_wait(lock, boost::posix_time::milliseconds(200)); //the signal handler can't notify us
+			bool last = m_stop;
+			if (last || DumpRequested() || (m_interval > 0 && scan_stats_now() >= next))
+			{
+				DumpRequested() = 0;
+				next = scan_stats_now() + m_interval * 1000000000ULL;
+				std::vector<latency_histogram> snapshot(m_histograms); //don't hold up the recorders while writing
+				lock.unlock();
+				Write(snapshot);
+				lock.lock();
+			}
+			if (last)
+				break;
+		}
+	}
+
+	/* Writes a new file and renames it over the old one, so readers never see half a table */
+	void Write(const std::vector<latency_histogram> &histograms)
+	{
+		std::string tmp = m_path + ".tmp";
+		FILE *file = fopen(tmp.c_str(), "w");
+		if (!file)
+		{
+			fprintf(stderr, "[!] can't write timing stats to %s\n", tmp.c_str());
+			return;
+		}
+
+		static const char *names[PHASE_COUNT] = {"retune", "settle", "wait", "average", "publish", "agc", "converge", "dwell"};
+		double uptime = (scan_stats_now() - m_start) / 1e9;
+		fprintf(file, "# gr-scan timing, %.1f s since start, times in ms\n", uptime);
+		fprintf(file, "%-8s %4s %10s %10s %10s %10s %10s %10s\n", "phase", "dev", "count", "mean", "p50", "p90", "p99", "max");
+		for (unsigned int d = 0; d < histograms.size() / PHASE_COUNT; ++d)
+		{
+			for (unsigned int p = 0; p < PHASE_COUNT; ++p)
+			{
+				const latency_histogram &h = histograms[d * PHASE_COUNT + p];
+				fprintf(file, "%-8s %4u %10llu %10.3f %10.3f %10.3f %10.3f %10.3f\n", names[p], d,
+					static_cast<unsigned long long>(h.count()), h.mean() / 1e6, h.Percentile(0.5) / 1e6,
+					h.Percentile(0.9) / 1e6, h.Percentile(0.99) / 1e6, h.max() / 1e6);
+			}
+			uint64_t dwells = histograms[d * PHASE_COUNT + PHASE_DWELL].count();
+			fprintf(file, "# device %u: %llu dwells, %.2f dwells/s\n", d, static_cast<unsigned long long>(dwells),
+				uptime > 0.0 ? dwells / uptime : 0.0);
+		}
+		fclose(file);
+		rename(tmp.c_str(), m_path.c_str());
+	}
+
+	std::string m_path;
+	unsigned int m_interval; //seconds, 0 for SIGUSR1 only
+	std::vector<latency_histogram> m_histograms; //PHASE_COUNT per device
+	uint64_t m_start;
+	unsigned int m_users; //sinks that have started us
+	bool m_stop;
+	boost::mutex m_mutex;
+	boost::condition_variable m_cond;
+	boost::thread m_thread;
+};
+
+typedef boost::shared_ptr<scan_stats> scan_stats_sptr;
+
+#endif
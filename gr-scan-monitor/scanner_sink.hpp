@@ -17,15 +17,21 @@
 	along with this program.  If not, see <http://www.gnu.org/licenses/>.
 */
 
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
 #include <ctime>
+#include <map>
 #include <set>
 #include <utility>
+#include <vector>
 
 #include <boost/shared_ptr.hpp>
 
 #include <gnuradio/block.h>
 #include <gnuradio/io_signature.h>
-#include <osmosdr/source.h>
+#include <gnuradio/tags.h>
+#include <pmt/pmt.h>
 
 #include <stdio.h>
 #include <stdint.h>
@@ -33,33 +39,111 @@
 #include <fcntl.h>
 #include <unistd.h>
 
-#include <sys/ipc.h>
-#include <sys/shm.h>
-
-#define SHM_SIZE 1000000
+#include "spectrum_kernels.hpp"
+#include "spectrum_frontend.hpp"
+#include "spectrum_pool.hpp"
+#include "scan_options.hpp"
+#include "zoom_stage.hpp"
+#include "scan_control.hpp"
+#include "spectrum_publisher.hpp"
+#include "iq_recorder.hpp"
+#include "gain_memory.hpp"
+#include "signal_detector.hpp"
 
 class scanner_sink : public gr::block
 {
 public:
-	scanner_sink(osmosdr::source::sptr source, unsigned int vector_length, double start_freq,
-		     double end_freq, double samples_per_second, double step, 
-		unsigned int avg_size, double def_gain, int use_AGC) :
+	scanner_sink(scan_source_sptr source, spectrum_pool_sptr pool, unsigned int vector_length, sweep_plan_sptr plan,
+		const sweep_dwell &start, double def_gain, spectrum_publisher_sptr publisher, unsigned int device,
+		scan_stats_sptr stats, iq_recorder_sptr recorder, gain_memory_sptr gains, const scan_options &options) :
 		gr::block("scanner_sink",
-			  gr::io_signature::make(1, 1, sizeof (float) * vector_length),
+			  gr::io_signature::make(1, 1, source->block()->output_signature()->sizeof_stream_item(0)),
 			  gr::io_signature::make(0, 0, 0)),
 		m_source(source), //We need the source in order to be able to control it
-		m_buffer(new float[vector_length]), //buffer into which we accumulate the total for averaging
+		m_int8(source->block()->output_signature()->sizeof_stream_item(0) == 2 * sizeof(int8_t)), //interleaved int8 I/Q instead of gr_complex
+		m_frontend(pool->frontend()), //window + FFT + |X|^2, done here instead of in separate blocks
+		m_pool(pool), //the same on several threads
+		m_spectra(vector_length * std::max(vector_length < 16384 ? 16384 / vector_length : 1, pool->threads())), //power spectra waiting to be accumulated, at least one per thread
+		m_buffer(vector_length, 0.0f), //buffer into which we accumulate the total for averaging
 		m_vector_length(vector_length), //size of the FFT
 		m_count(0), //number of FFTs totalled in the buffer
 		m_wait_count(0), //number of times we've listenned on this frequency
-		m_avg_size(avg_size), //the number of FFTs we should average over
-		m_step(step), //the amount by which the frequency shold be incremented
-		m_start_freq(start_freq), //start frequency
-		m_end_freq(end_freq), //end frequency
-		m_sps(samples_per_second), //samples per second
+		m_avg_size(options.avg_size > 0 ? options.avg_size : 1), //the number of FFTs we should average over
+		m_sps(options.sample_rate), //samples per second
 		m_start_time(time(0)), //the start time of the scan (useful for logging/reporting/monitoring)
-		m_default_gain(def_gain)
+		m_default_gain(def_gain),
+		m_moments(options.duty_level > 0.0f), //per-bin spectral kurtosis and duty cycle
+		m_hold(options.hold), //per-bin max-hold and min-hold
+		m_accumulate(select_accumulate_batch((m_moments ? ACCUMULATE_MOMENTS : 0) | (m_hold ? ACCUMULATE_HOLD : 0))), //fastest accumulation kernel for this CPU
+		m_inner_begin(vector_length > 21 ? 11 : 0), //the AGC ignores the 10 outermost bins on each side
+		m_inner_end(vector_length > 21 ? vector_length - 10 : vector_length),
+		m_top_threshold(0.0),
+		m_squares(m_moments ? vector_length : 0, 0.0f),
+		m_crossings(m_moments ? vector_length : 0, 0.0f),
+		m_max(m_hold ? vector_length : 0, 0.0f),
+		m_min(m_hold ? vector_length : 0, FLT_MAX),
+		m_persist_levels(options.persistence_step > 0.0f ? PersistenceLevels(vector_length, options.sample_rate, options.resolutions) : 0),
+		m_persist(m_persist_levels > 0), //histogram of every bin's level over the dwell
+		m_persistence(static_cast<size_t>(vector_length) * m_persist_levels, 0),
+		m_persist_db(m_persist ? vector_length : 0),
+		m_persist_level(m_persist ? vector_length : 0),
+		m_persistence_batch(select_persistence_batch()),
+		m_persist_inv_step(m_persist ? 1.0f / options.persistence_step : 0.0f),
+		m_rx_freq_key(pmt::intern("rx_freq")), //tag sources put on the first sample after a retune
+		m_settle_samples(static_cast<uint64_t>(options.settle_time * options.sample_rate)), //PLL settling after a retune
+		m_discard_until(m_settle_samples), //the source was tuned just before we started
+		m_tag_deadline(0),
+		m_tuned_freq(start.lo),
+		m_retuned(false),
+		m_waiting_for_tag(false),
+		m_have_freq_tags(false),
+		m_control(source, plan, start, stats, device, options.use_AGC ? gains : gain_memory_sptr()), //retunes and gain changes, off the sample thread
+		m_finalizer(vector_length, m_moments, m_hold, m_persist_levels, boost::bind(&scanner_sink::WriteDwell, this, _1)), //turns finished dwells into spectra
+		m_publisher(publisher), //shared memory and dwell log, shared by all devices
+		m_device(device), //which device this sink reads from
+		m_log_db(select_log_db()), //fastest dB conversion for this CPU
+		m_bands(vector_length),
+		m_resolutions(options.resolutions), //coarser spectra published with every dwell, in Hz
+		m_levels(options.resolutions.size()),
+		m_merge_centres(vector_length),
+		m_welford(select_welford_batch()),
+		m_adaptive(options.tolerance > 0.0 && options.min_avg_size < m_avg_size), //stop a dwell early once its spectrum is known well enough
+		m_min_avg_size(options.min_avg_size > 2 ? options.min_avg_size : 2),
+		m_next_check(m_min_avg_size),
+		m_tolerance_ratio(pow(10.0, options.tolerance / 10.0) - 1.0), //tolerance in dB as a linear power ratio
+		m_mean(m_adaptive ? vector_length : 0, 0.0f),
+		m_m2(m_adaptive ? vector_length : 0, 0.0f),
+		m_timing(stats), //where each dwell's time goes
+		m_dwell_begin(0),
+		m_capture_begin(0),
+		m_work_begin(0),
+		m_average_time(0),
+		m_recorder(recorder), //raw IQ of every dwell, if asked for
+		m_last_gain(0.0),
+		m_gains(options.use_AGC ? gains : gain_memory_sptr()), //converged AGC gains by LO, if kept
+		m_converge_vectors(0),
+		m_detect(options.detect_threshold > 0.0f), //look for signals in every dwell
+		m_detector(options.detect_threshold),
+		m_noise_floor(0.0f),
+		m_kurtosis(m_moments ? vector_length : 0),
+		m_duty(m_moments ? vector_length : 0),
+		m_max_hold(m_hold ? vector_length : 0),
+		m_min_hold(m_hold ? vector_length : 0)
 	{
+		m_bin_moments.squares = m_bin_moments.crossings = NULL; //set per batch
+		m_bin_moments.ratio = pow(10.0, options.duty_level / 10.0); //crossing level over the noise
+		m_bin_hold.max = m_bin_hold.min = NULL;
+		m_published_persistence.floor = persistence_floor;
+		m_published_persistence.step = options.persistence_step;
+		m_published_persistence.levels = m_persist_levels;
+		m_published_persistence.rle.resize(m_persist ? static_cast<size_t>(vector_length) * persistence_rle_bound(m_persist_levels) : 0);
+		m_published_persistence.size = 0;
+		if (options.persistence_step > 0.0f && !m_persist)
+			fprintf(stderr, "[!] no room in shared memory for a persistence histogram of %u bins\n", vector_length);
+		else if (options.persistence_step > 0.0f && m_persist_levels < max_persistence_levels)
+			fprintf(stderr, "[!] only %u persistence levels fit into shared memory with %u bins\n", m_persist_levels, vector_length);
+		set_relative_rate(1.0 / vector_length); //one FFT per vector_length samples
+
 		current_gain_RF = 0;
 		current_gain_IF = 0;
 		rf_gain_mod = 0; //compensation for RF gain not equal to 14dB in hardware
@@ -68,73 +152,282 @@ public:
 		agc_power_level = 0.5*(agc_threshold_high + agc_threshold_low); //init at value that won't force gain change at the beginning
 
 		gain_change_timeout = 0;
-		m_current_freq = start_freq;
-		m_use_AGC = use_AGC;
-
-		last_log_out = 0;
-		ZeroBuffer();
-		key_t key = 47192032; //some random number that must be the same in monitor shared mem module
-		int shmid;
-
-		if ((shmid = shmget(key, SHM_SIZE, IPC_CREAT | 0666)) < 0) {
-		printf("shmget error!\n");
-		}
-
-		if ((shared_memory = (uint8_t*)shmat(shmid, NULL, 0)) == (uint8_t *) -1) {
-		printf("shmat error!\n");
+		BeginDwell(start, start.lo);
+		m_use_AGC = options.use_AGC;
+		double rf, if_gain;
+		if (m_gains && m_gains->Lookup(device, start.lo, rf, if_gain)) //TopBlock started the source at 0 dB
+		{
+			current_gain_RF = rf;
+			current_gain_IF = if_gain;
+			m_source->set_gain(rf, "RF");
+			m_source->set_gain(if_gain, "IF");
 		}
 	}
 
 	virtual ~scanner_sink()
 	{
-		delete []m_buffer; //delete the buffer
+	}
+
+	virtual bool start()
+	{
+		m_publisher->Start();
+		m_timing->Start();
+		if (m_recorder)
+			m_recorder->Start();
+		m_dwell_begin = scan_stats_now(); //the source was tuned just before we started
+		m_control.Start();
+		m_finalizer.Start();
+		m_pool->Start();
+		return gr::block::start();
+	}
+
+	virtual bool stop()
+	{
+		m_control.Stop();
+		m_finalizer.Stop();
+		m_pool->Stop();
+		if (m_recorder)
+			m_recorder->Stop();
+		if (m_gains)
+			m_gains->Save();
+		m_timing->Stop();
+		m_publisher->Stop();
+		return gr::block::stop();
 	}
 
 private:
 	virtual int general_work(int noutput_items, gr_vector_int &ninput_items, gr_vector_const_void_star &input_items, gr_vector_void_star &output_items)
 	{
-		for (int i = 0; i < ninput_items[0]; ++i)
-			ProcessVector(static_cast<const float *>(input_items[0]) + i * m_vector_length);
+		const gr_complex *samples = m_int8 ? NULL : static_cast<const gr_complex *>(input_items[0]);
+		const int8_t *samples8 = m_int8 ? static_cast<const int8_t *>(input_items[0]) : NULL; //until something needs gr_complex
+		const uint64_t first = nitems_read(0);
+		const unsigned int available = ninput_items[0];
+		const unsigned int batch_size = m_spectra.size() / m_vector_length;
+		const unsigned int hop = m_frontend->hop();
+
+		sweep_dwell dwell;
+		double actual, rf, if_gain;
+		bool recalled;
+		switch (m_control.PollRetune(dwell, actual, recalled, rf, if_gain))
+		{
+		case tuning_control::RETUNE_PENDING: //the source is still moving, nothing here is usable
+			consume_each(available);
+			return 0;
+		case tuning_control::RETUNE_DONE: //everything queued up to here was captured before the retune
+			BeginDwell(dwell, actual);
+			if (recalled) //the source already has the gains we ended the last visit with
+			{
+				current_gain_RF = rf;
+				current_gain_IF = if_gain;
+				agc_power_level = 0.5*(agc_threshold_high + agc_threshold_low); //the level measured at the previous frequency says nothing about this one
+				gain_change_timeout = 0;
+			}
+			m_dwell_begin = scan_stats_now();
+			m_discard_until = first + available + m_settle_samples;
+			m_waiting_for_tag = m_have_freq_tags;
+			m_tag_deadline = first + available + static_cast<uint64_t>(m_sps);
+			consume_each(available);
+			return 0;
+		}
 
-		consume_each(ninput_items[0]);
+		unsigned int skip = SettlingSamples(first, available); //samples from before the last retune
+		unsigned int count = available - skip;
+		if (count > 0)
+		{
+			m_work_begin = scan_stats_now();
+			if (m_capture_begin == 0) //first usable sample of the dwell
+			{
+				m_capture_begin = m_work_begin;
+				m_timing->Record(m_device, scan_stats::PHASE_SETTLE, m_capture_begin - m_dwell_begin);
+			}
+		}
+		if (m_int8)
+		{
+			samples8 += 2 * skip;
+			if (count > 0 && (m_zoom.decimation() > 1 || m_recorder)) //the zoom filter and the recorder take gr_complex
+			{
+				if (m_converted.size() < count)
+					m_converted.resize(count);
+				volk_8i_s32f_convert_32f(reinterpret_cast<float *>(&m_converted[0]), samples8, 1.0f / spectrum_frontend::int8_scale(), 2 * count);
+				samples = &m_converted[0];
+				samples8 = NULL;
+			}
+		}
+		else
+			samples += skip;
+		const gr_complex *raw = samples; //for the recorder
+		const unsigned int raw_count = count;
+		if (m_zoom.decimation() > 1) //zoomed dwell: the FFTs run over the decimated samples
+		{
+			m_zoom.Push(samples, count);
+			samples = m_zoom.data();
+			count = m_zoom.size();
+		}
+		unsigned int vectors = m_frontend->VectorsIn(count);
+		unsigned int used = vectors * hop; //with overlap, the tail of the last FFT is reused next time
+		unsigned int consumed = m_zoom.decimation() > 1 ? available : skip + used;
+
+		unsigned int processed = 0; //vectors that went into the dwell
+		m_retuned = false;
+		while (vectors > 0 && !m_retuned)
+		{
+			unsigned int batch = vectors < batch_size ? vectors : batch_size;
+			if (samples8) //converted and windowed in one go
+			{
+				m_pool->Transform(samples8, batch, &m_spectra[0]);
+				samples8 += 2 * batch * hop;
+			}
+			else
+			{
+				m_pool->Transform(samples, batch, &m_spectra[0]);
+				samples += batch * hop;
+			}
+			vectors -= batch;
+
+			const float *input = &m_spectra[0];
+			while (batch > 0 && !m_retuned)
+			{
+				unsigned int done = ProcessBatch(input, batch);
+				processed += done;
+				input += done * m_vector_length;
+				batch -= done;
+			}
+		}
+
+		if (m_recorder && raw_count > 0)
+			RecordSamples(raw, raw_count, processed, used);
+
+		if (m_retuned) //the rest was captured at the old frequency
+		{
+			consumed = available;
+			m_zoom.Reset();
+		}
+		else
+		{
+			if (m_zoom.decimation() > 1)
+				m_zoom.Consume(used);
+			if (count > 0)
+				m_average_time += scan_stats_now() - m_work_begin;
+		}
+
+		consume_each(consumed);
 		return 0;
 	}
 
-	void ProcessVector(const float *input)
+	/* Returns how many of the available samples starting at absolute index first
+	 * must be dropped because they predate the last retune or fall into the settling
+	 * window after it. Sources that tag the retune point with rx_freq give us the
+	 * exact first sample at the new frequency; for the others we drop whatever was
+	 * queued when we retuned plus the settling window. */
+	unsigned int SettlingSamples(uint64_t first, unsigned int available)
 	{
-		float sample_max = -100;
-		float sample_average = 0;
-		float sample_top_average = 0;
-		float avg_z = 0;
-		float avg_top_z = 0;
-		float signal_mult = 1.0;//pow(10, -(m_default_gain + current_gain) * 0.1);
-		for (unsigned int i = 0; i < m_vector_length; ++i)
+		std::vector<gr::tag_t> tags;
+		get_tags_in_range(tags, 0, first, first + available, m_rx_freq_key);
+		for (unsigned int t = 0; t < tags.size(); ++t)
+		{
+			m_have_freq_tags = true;
+			if (m_waiting_for_tag && fabs(pmt::to_double(tags[t].value) - m_tuned_freq) < 100.0)
+			{
+				m_waiting_for_tag = false;
+				m_discard_until = tags[t].offset + m_settle_samples;
+			}
+		}
+		if (m_waiting_for_tag && first + available > m_tag_deadline) //the tag never came, fall back to counting
+			m_waiting_for_tag = false;
+
+		if (m_waiting_for_tag)
+			return available;
+		if (first >= m_discard_until)
+			return 0;
+		return m_discard_until - first < available ? m_discard_until - first : available;
+	}
+
+	/* Hands the raw samples behind the vectors used in this work call to the recorder:
+	 * everything consumed, or up to the end of the last FFT if the dwell finished here.
+	 * Zoomed dwells keep all of it, the zoom filter has seen it all. */
+	void RecordSamples(const gr_complex *raw, unsigned int raw_count, unsigned int processed, unsigned int used)
+	{
+		unsigned int count = used;
+		if (m_zoom.decimation() > 1)
+			count = raw_count;
+		else if (m_retuned)
+			count = processed > 0 ? (processed - 1) * m_frontend->hop() + m_frontend->span() : 0;
+		m_recorder->Record(raw, count < raw_count ? count : raw_count);
+		if (m_retuned)
+			m_recorder->EndDwell(m_tuned_freq, m_current_freq, m_current_span * m_current_bins / m_vector_length, m_last_gain);
+	}
+
+	/* Starts listening to dwell, for which the source reported an LO of actual */
+	void BeginDwell(const sweep_dwell &dwell, double actual)
+	{
+		m_current_freq = dwell.centre;
+		m_current_lo = dwell.lo;
+		m_tuned_freq = actual;
+		m_current_span = m_sps / dwell.decimation;
+		m_current_first = dwell.first;
+		m_current_bins = dwell.bins;
+		m_top_threshold = 0.0f; //likewise its mean: the first vector's top average is over all its bins
+		m_bin_moments.level = FLT_MAX; //the noise of the last frequency says nothing here, count no crossings until we know ours
+		m_zoom.Configure(dwell.decimation, (actual - dwell.centre) / m_sps); //moves the centre to DC
+	}
+
+	/* Accumulates as many of the count vectors as still belong to the current dwell,
+	 * finishing the dwell if it is complete. Returns the number of vectors used. */
+	unsigned int ProcessBatch(const float *input, unsigned int count)
+	{
+		unsigned int limit = m_adaptive && m_next_check < m_avg_size ? m_next_check : m_avg_size;
+		if (count > limit - m_count) //never run a batch across the end of a dwell (or a convergence check)
+			count = limit - m_count;
+		if (m_stats.size() < count)
+			m_stats.resize(count);
+
+		if (m_moments) //the finalizer hands back different buffers every dwell
 		{
-			if(i > 10 && i < m_vector_length - 10)
+			m_bin_moments.squares = &m_squares[0];
+			m_bin_moments.crossings = &m_crossings[0];
+		}
+		if (m_hold)
+		{
+			m_bin_hold.max = &m_max[0];
+			m_bin_hold.min = &m_min[0];
+		}
+		m_accumulate(&m_buffer[0], input, count, m_vector_length, m_inner_begin, m_inner_end, &m_top_threshold, &m_stats[0],
+			&m_bin_moments, &m_bin_hold);
+		if (m_persist) //levels at the gain the vectors were taken with, while they are still in cache
+			m_persistence_batch(&m_persistence[0], input, count, m_vector_length,
+				-38.0f - (m_default_gain + current_gain_IF + current_gain_RF + rf_gain_mod) - persistence_floor, m_persist_inv_step,
+				m_persist_levels, &m_persist_db[0], &m_persist_level[0]);
+		if (m_adaptive)
+			m_welford(&m_mean[0], &m_m2[0], input, count, m_vector_length, m_count);
+		for (unsigned int v = 0; v < count; ++v)
+			if (UpdateGain(m_stats[v]))
+				m_converge_vectors = m_count + v + 1;
+		m_count += count;
+
+		if (m_adaptive && m_count == m_next_check && m_count < m_avg_size)
+		{
+			if (welford_converged(&m_mean[0], &m_m2[0], m_inner_begin, m_inner_end, m_count, 1.96f, m_tolerance_ratio)) //95% confidence
 			{
-				sample_average += input[i];
-				avg_z++;
-				if(sample_max < input[i]) sample_max = input[i];
+				FinishDwell();
+				return count;
 			}
-			m_buffer[i] += input[i]*signal_mult; //if gain is turned on, adjust signal to fit
+			m_next_check += check_interval;
 		}
-		sample_average /= avg_z;
-		++m_count; //increment the total
+		if (m_count >= m_avg_size)
+			FinishDwell();
+		return count;
+	}
 
+	/* Returns true if the gain was changed */
+	bool UpdateGain(const vector_stats &stats)
+	{
 		if(current_gain_RF > 1) rf_gain_mod = -8;
 		else rf_gain_mod = 0;
 		if(m_use_AGC)
 		{
-			for (unsigned int i = 0; i < m_vector_length; ++i)
-			{
-				if(i > 10 && i < m_vector_length - 10)
-					if(input[i] > sample_average)
-					{
-						sample_top_average += input[i];
-						avg_top_z++;
-					}
-			}
-			sample_top_average /= avg_top_z;
+			float sample_top_average = stats.sum / (m_inner_end - m_inner_begin);
+			if(stats.top_count > 0) //a stale threshold right after a retune can leave nothing above it
+				sample_top_average = stats.top_sum / stats.top_count;
 
 			agc_power_level *= 0.9;
 			agc_power_level += 0.1 * sample_top_average;
@@ -148,9 +441,9 @@ private:
 				else
 					current_gain_IF += 8;
 				if(current_gain_IF > 40) current_gain_IF = 40;
-				m_source->set_gain(current_gain_RF, "RF");
-				m_source->set_gain(current_gain_IF, "IF");
+				m_control.RequestGain(current_gain_RF, current_gain_IF);
 				gain_change_timeout = 200;
+				return true;
 			}
 
 			if(agc_power_level > agc_threshold_high && gain_change_timeout < 1) //decrease gain
@@ -160,54 +453,140 @@ private:
 				else
 					current_gain_RF = 0;
 				if(current_gain_IF < 0) current_gain_IF = 0;
-				m_source->set_gain(current_gain_RF, "RF");
-				m_source->set_gain(current_gain_IF, "IF");
+				m_control.RequestGain(current_gain_RF, current_gain_IF);
 				gain_change_timeout = 200;
+				return true;
 			}
 		}
+		return false;
+	}
 
-		if (m_count < m_avg_size) //we haven't yet averaged over the number we intended to
-			return;
+	/* Hands the accumulator to the finalizer thread and asks for the next frequency.
+	 * Both return straight away, so we go back to draining samples while the source
+	 * retunes and the last dwell is written out. */
+	void FinishDwell()
+	{
+		uint64_t now = scan_stats_now();
+		uint64_t capture = now - m_capture_begin;
+		m_average_time += now - m_work_begin;
+		m_timing->Record(m_device, scan_stats::PHASE_AVERAGE, m_average_time);
+		m_timing->Record(m_device, scan_stats::PHASE_WAIT, capture > m_average_time ? capture - m_average_time : 0);
+		m_timing->Record(m_device, scan_stats::PHASE_DWELL, now - m_dwell_begin);
+		m_capture_begin = 0;
+		m_average_time = 0;
+		if (m_use_AGC)
+		{
+			m_timing->Record(m_device, scan_stats::PHASE_CONVERGE, static_cast<uint64_t>(m_converge_vectors * 1e9 * m_frontend->hop() / m_current_span));
+			m_converge_vectors = 0;
+			if (m_gains)
+				m_gains->Store(m_device, m_current_lo, current_gain_RF, current_gain_IF);
+		}
 
+		m_last_gain = m_default_gain + current_gain_IF + current_gain_RF + rf_gain_mod;
+		m_finalizer.Submit(m_buffer, m_squares, m_crossings, m_max, m_min, m_persistence, m_current_freq, m_tuned_freq, m_current_span, m_current_first, m_current_bins, m_last_gain, m_count);
+		m_count = 0; //next time, we're starting from scratch - so note this
+		if (m_adaptive)
+		{
+			m_next_check = m_min_avg_size;
+			std::fill(m_mean.begin(), m_mean.end(), 0.0f);
+			std::fill(m_m2.begin(), m_m2.end(), 0.0f);
+		}
 
-		double freqs[m_vector_length]; //for convenience
-		float bands0[m_vector_length]; //bands in order of frequency
+		++m_wait_count; //we've just done another listen
+		m_control.RequestRetune();
+		m_wait_count = 0; //new frequency - we've listened 0 times on it
+		m_retuned = true; //drop what was captured before this point
+	}
 
-		Rearrange(bands0, freqs, m_current_freq, m_sps); //organise the buffer into a convenient order (saves to bands0)
-		for(unsigned int n = 0; n < m_vector_length; n++)
+	/* Runs on the finalizer thread */
+	void WriteDwell(dwell_record &dwell)
+	{
+		/* fftshift, average and dB in one pass: dividing by count is folded into the offset */
+		float offset = -10.0f * log10f(static_cast<float>(dwell.count)) - 38.0f - dwell.gain;
+		finalize_dwell(m_log_db, &m_bands[0], &dwell.buffer[0], m_vector_length, offset);
+		if (m_hold) //single spectra, no count to divide by
 		{
-			bands0[n] = 10*log10(bands0[n]) - 38.0 - (m_default_gain + current_gain_IF + current_gain_RF + rf_gain_mod);
+			finalize_dwell(m_log_db, &m_max_hold[0], &dwell.max[0], m_vector_length, -38.0f - dwell.gain);
+			finalize_dwell(m_log_db, &m_min_hold[0], &dwell.min[0], m_vector_length, -38.0f - dwell.gain);
 		}
-		PrintSignals(freqs, bands0);
-
-//		m_source->set_gain(m_default_gain); //by default, set gain to match 1dBm
-//		m_gain_mode = 1;
+		if (m_persist)
+			m_published_persistence.size = persistence_rle(&m_published_persistence.rle[0], &dwell.persistence[0], m_vector_length,
+				m_persist_levels, dwell.first, dwell.first + dwell.bins);
+		if (m_moments)
+			finalize_moments(&m_kurtosis[0], &m_duty[0], &dwell.buffer[0], &dwell.squares[0], &dwell.crossings[0], m_vector_length, dwell.count);
+
+		/* Offset tuned dwells publish a window of the spectrum centred on dwell.centre;
+		 * the axis is that of the whole spectrum, centred where the window says */
+		const double width = dwell.span / m_vector_length; //of a bin
+		const double spectrum_centre = dwell.centre - (dwell.first + dwell.bins / 2.0 - m_vector_length / 2.0) * width;
+		const double *freqs = FrequencyAxis(spectrum_centre, dwell.span) + dwell.first;
+
+		/* Bins spoilt by the LO, if the window has any: DC sits at bin n/2 of a spectrum centred on the LO */
+		double dc = floor((dwell.lo - spectrum_centre) / width + m_vector_length / 2.0 + 0.5) - dwell.first;
+		double dc_first = std::max(dc - sweep_segment::dc_guard, 0.0);
+		double dc_end = std::min(dc + sweep_segment::dc_guard + 1.0, static_cast<double>(dwell.bins));
+		unsigned int dc_count = dc_end > dc_first ? static_cast<unsigned int>(dc_end - dc_first) : 0;
+
+		if (dc_count == 0)
+			dc_first = 0;
+		MergeLevels(dwell, offset, spectrum_centre - dwell.span / 2.0, static_cast<unsigned int>(dc_first), dc_count);
+
+		uint64_t begin = scan_stats_now();
+		PrintSignals(freqs, &m_bands[dwell.first], dwell, spectrum_centre - dwell.span / 2.0 + dwell.first * width,
+			static_cast<unsigned int>(dc_first), dc_count);
+		m_timing->Record(m_device, scan_stats::PHASE_PUBLISH, scan_stats_now() - begin);
+		if (m_gains)
+			m_gains->SaveIfDue();
+	}
 
-		m_count = 0; //next time, we're starting from scratch - so note this
-		ZeroBuffer(); //get ready to start again
+	/* Persistence levels the shared memory has room for next to everything else
+	 * published with a dwell of vector_length bins. A coarser spectrum has at most
+	 * half the bins and no more than one per resolution of the sampled band. */
+	static unsigned int PersistenceLevels(unsigned int vector_length, double samples_per_second, const std::vector<double> &resolutions)
+	{
+		unsigned int coarse = 0;
+		for (size_t l = 0; l < resolutions.size(); ++l)
+			coarse += 2 + 2 * std::min(vector_length / 2, static_cast<unsigned int>(samples_per_second / resolutions[l]) + 1);
+		return spectrum_publisher::PersistenceLevels(vector_length, coarse, max_persistence_levels);
+	}
 
-		++m_wait_count; //we've just done another listen
-		if(1){
-			for (;;) { //keep moving to the next frequency until we get to one we can listen on (copes with holes in the tunable range)
-				if (m_current_freq >= m_end_freq) { //we reached the end!
-//					m_step = -m_step;
-					//do something to end the scan
-					fprintf(stderr, "[*] Finished range, starting again\n"); //say we're exiting
-					m_current_freq = m_start_freq;
-//					exit(0); //TODO: This probably isn't the right thing, but it'll do for now
-				}
-
-				m_current_freq += m_step; //calculate the frequency we should change to
-				double actual = m_source->set_center_freq(m_current_freq); //change frequency
-				if (fabs(m_current_freq - actual) < 100.0) //success
-					break; //so stop changing frequency
-			}
-			m_wait_count = 0; //new frequency - we've listened 0 times on it
+	/* The coarser spectra, by merging the usable bins of the dwell (not the edges,
+	 * not the bins around DC). low is the frequency of bin 0 of the whole spectrum. */
+	void MergeLevels(const dwell_record &dwell, float offset, double low, unsigned int dc_first, unsigned int dc_count)
+	{
+		const double width = dwell.span / m_vector_length;
+		unsigned int begin = dwell.first, end = dwell.first + dwell.bins;
+		if (dwell.bins == m_vector_length)
+		{
+			begin = m_frontend->EdgeBins();
+			end = m_vector_length - begin;
+		}
+		for (size_t l = 0; l < m_resolutions.size(); ++l)
+		{
+			spectrum_level &level = m_levels[l];
+			unsigned int factor = static_cast<unsigned int>(m_resolutions[l] / width + 0.5);
+			level.count = 0;
+			if (factor < 2 || (end - begin) / factor < 2) //no coarser than the spectrum itself, or hardly anything left
+				continue;
+			level.resolution = factor * width;
+			level.freqs.resize((end - begin) / factor);
+			level.bands.resize((end - begin) / factor);
+			level.count = merge_bins(&level.bands[0], &m_merge_centres[0], &dwell.buffer[0], m_vector_length, begin, end, factor,
+				dwell.first + dc_first, dwell.first + dc_first + dc_count);
+			m_log_db(&level.bands[0], &level.bands[0], level.count, offset);
+			for (unsigned int r = 0; r < level.count; ++r)
+				level.freqs[r] = low + m_merge_centres[r] * width;
 		}
 	}
 
-	void PrintSignals(double *freqs, float *bands0)
+	/* low is the frequency of the first published bin */
+	void PrintSignals(const double *freqs, const float *bands0, const dwell_record &dwell, double low, unsigned int dc_first,
+		unsigned int dc_count)
 	{
+		const double centre = dwell.centre;
+		const double span = dwell.span * dwell.bins / m_vector_length; //published
+		const unsigned int edge = dwell.bins < m_vector_length ? 0 : m_frontend->EdgeBins(); //a window is all usable bins
+
 		/* Calculate the current time after start */
 		unsigned int t = time(NULL) - m_start_time;
 		unsigned int hours = t / 3600;
@@ -215,94 +594,167 @@ private:
 		unsigned int seconds = t % 60;
 
 		//Print that we finished scanning something
-		fprintf(stderr, "%02u:%02u:%02u: Finished scanning %f MHz - %f MHz\n",
-			hours, minutes, seconds, (m_current_freq - m_sps/2.0)/1000000.0, (m_current_freq + m_sps/2.0)/1000000.0);
-
-		if(fabs(m_current_freq - last_log_out) >= 1000000.0)
+		if (m_publisher->devices() > 1)
+			fprintf(stderr, "%02u:%02u:%02u: [dev %u] Finished scanning %f MHz - %f MHz (%u FFTs)\n",
+				hours, minutes, seconds, m_device, (centre - span/2.0)/1000000.0, (centre + span/2.0)/1000000.0, dwell.count);
+		else
+			fprintf(stderr, "%02u:%02u:%02u: Finished scanning %f MHz - %f MHz (%u FFTs)\n",
+				hours, minutes, seconds, (centre - span/2.0)/1000000.0, (centre + span/2.0)/1000000.0, dwell.count);
+
+		if (m_detect)
 		{
-			last_log_out = m_current_freq;
-			char logfn[512];
-			sprintf(logfn, "logs/signal_%02u_%02u_%02u_%f_%f.txt", hours, minutes, seconds, (m_current_freq - m_sps/2.0)/1000000.0, (m_current_freq + m_sps/2.0)/1000000.0);
-			int log_file = open(logfn, O_WRONLY | O_CREAT, 0b110110110);
-			if(log_file > 0)
+			m_noise_floor = m_detector.Detect(bands0, edge, dwell.bins - edge, dc_first, dc_first + dc_count,
+				low, dwell.span / m_vector_length, m_events);
+			for (size_t e = 0; e < m_events.size(); ++e)
 			{
-				char line[1024];
-				for (unsigned int i = 0; i < m_vector_length; i++){
-					int lng = sprintf(line, "%g %g\n", freqs[i], bands0[i]);
-					int sz = write(log_file, line, lng);
-					if(sz < 0) printf("log file write failed\n");
-				}
-				close(log_file);
+				const signal_event &event = m_events[e];
+				if (TrySignal(event.centre, event.bandwidth))
+					printf("[+] %02u:%02u:%02u: Found signal: at %f MHz of width %f kHz, peak power %f dB (SNR %f dB)\n",
+						hours, minutes, seconds, event.centre/1000000.0, event.bandwidth/1000.0, event.peak, event.snr);
 			}
 		}
-		float *f_shm = (float*)shared_memory;
-		int *i_shm = (int*)shared_memory;
-		i_shm[4] = m_vector_length;
-		f_shm[1] = current_gain_IF + current_gain_RF + rf_gain_mod + m_default_gain;
-	
-		int rpos = 0;
-		for(unsigned int r = 0; r < m_vector_length; r++)
-		{
-			f_shm[5 + rpos*2] = freqs[r];
-			f_shm[6 + rpos*2] = bands0[r];
-			rpos++;
-		}
-
-		i_shm[0]++;
+		m_publisher->Publish(m_device, centre, span, dwell.gain, dwell.count, freqs, bands0, dwell.bins, edge, dc_first, dc_count, m_levels,
+			m_detect ? &m_events : NULL, m_noise_floor, m_moments ? &m_kurtosis[dwell.first] : NULL, m_moments ? &m_duty[dwell.first] : NULL,
+			m_hold ? &m_max_hold[dwell.first] : NULL, m_hold ? &m_min_hold[dwell.first] : NULL,
+			m_persist ? &m_published_persistence : NULL);
 	}
 
-	void Rearrange(float *bands, double *freqs, double centre, double bandwidth)
+	/* True the first time a signal shows up at centre: nothing seen so far lies within
+	 * its bandwidth (or a bin of it), so every dwell's detections aren't all news */
+	bool TrySignal(double centre, double bandwidth)
 	{
-		double samplewidth = bandwidth/(double)m_vector_length;
-		for (unsigned int i = 0; i < m_vector_length; ++i) {
-			/* FFT is arranged starting at 0 Hz at the start, rather than in the middle */
-			if (i < m_vector_length / 2) //lower half of the fft
-				bands[i + m_vector_length / 2] = m_buffer[i] / static_cast<float>(m_avg_size);
-			else //upper half of the fft
-				bands[i - m_vector_length / 2] = m_buffer[i] / static_cast<float>(m_avg_size);
-
-			freqs[i] = centre + i * samplewidth - bandwidth / 2.0; //calculate the frequency of this sample
-		}
+		double reach = std::max(bandwidth / 2.0, m_sps / m_vector_length);
+		std::set<double>::const_iterator it = m_signals.lower_bound(centre - reach);
+		if (it != m_signals.end() && *it <= centre + reach)
+			return false;
+		m_signals.insert(centre);
+		return true;
 	}
 
-	void ZeroBuffer()
+	/* Frequency of every published bin for a dwell at centre. The sweep revisits the
+	 * same centres over and over, so axes are kept until they would take more than
+	 * max_axis_bytes; past that they are computed into a scratch buffer each time.
+	 * In double: zoomed bins can be narrower than a float's 256 Hz step above 2 GHz. */
+	const double *FrequencyAxis(double centre, double span)
 	{
-		/* writes zeros to m_buffer */
+		std::map<std::pair<double, double>, std::vector<double> >::iterator it = m_axes.find(std::make_pair(centre, span));
+		if (it != m_axes.end())
+			return &it->second[0];
+
+		std::vector<double> *axis = &m_axis_scratch;
+		if ((m_axes.size() + 1) * m_vector_length * sizeof(double) <= max_axis_bytes)
+			axis = &m_axes[std::make_pair(centre, span)];
+		axis->resize(m_vector_length);
+		double samplewidth = span/(double)m_vector_length;
 		for (unsigned int i = 0; i < m_vector_length; ++i)
-			m_buffer[i] = 0.0;
+			(*axis)[i] = centre + i * samplewidth - span / 2.0; //calculate the frequency of this sample
+		return &(*axis)[0];
 	}
 
-	std::set<double> m_signals;
-	osmosdr::source::sptr m_source;
-	float *m_buffer;
+	static const size_t max_axis_bytes = 64 << 20;
+	static const unsigned int max_persistence_levels = 128; //from persistence_floor up, -Z dB each
+	static const int persistence_floor = -130; //dB, below the bottom of the monitor's scale
+
+	std::set<double> m_signals; //centres of the signals found so far, finalizer thread only
+	scan_source_sptr m_source;
+	bool m_int8;
+	std::vector<gr_complex> m_converted; //8 bit samples for the zoom filter or the recorder
+	spectrum_frontend_sptr m_frontend;
+	spectrum_pool_sptr m_pool;
+	std::vector<float> m_spectra;
+	std::vector<float> m_buffer;
 	unsigned int m_vector_length;
 	unsigned int m_count;
 	unsigned int m_wait_count;
 	unsigned int m_avg_size;
-	double m_step;
-	double m_start_freq;
 	double m_current_freq;
-	double m_end_freq;
+	double m_current_lo; //LO the sweep plan asked for, the gain memory's key
+	double m_current_span; //bandwidth of the current dwell's spectra, m_sps unless zoomed
+	unsigned int m_current_first; //window of the spectrum the current dwell publishes
+	unsigned int m_current_bins;
 	double m_sps;
 	time_t m_start_time;
 	int m_gain_mode; //check whether gain was turned off already
 	int m_use_AGC;
 	double m_default_gain; //BB gain in dBm
+	bool m_moments;
+	bool m_hold;
+	accumulate_batch_fn m_accumulate;
+	unsigned int m_inner_begin; //first bin used for the AGC statistics
+	unsigned int m_inner_end; //one past the last bin used for the AGC statistics
+	float m_top_threshold; //mean of the previous vector, splits off the AGC top average
+	std::vector<vector_stats> m_stats; //per-vector statistics of the current batch
+	std::vector<float> m_squares; //sum of the squared power of every bin of this dwell, if m_moments
+	std::vector<float> m_crossings; //vectors in which every bin was above the duty cycle level, if m_moments
+	std::vector<float> m_max; //largest power of every bin in this dwell, if m_hold
+	std::vector<float> m_min; //smallest
+	bin_moments m_bin_moments;
+	bin_hold m_bin_hold;
+	unsigned int m_persist_levels; //as many as the shared memory has room for, 0 without -Z
+	bool m_persist;
+	std::vector<uint16_t> m_persistence; //per bin and level, the number of vectors there
+	std::vector<float> m_persist_db; //scratch for m_persistence_batch
+	std::vector<uint32_t> m_persist_level;
+	persistence_batch_fn m_persistence_batch;
+	float m_persist_inv_step; //levels per dB
+	pmt::pmt_t m_rx_freq_key;
+	uint64_t m_settle_samples; //samples to drop after every retune
+	uint64_t m_discard_until; //absolute index of the first sample we may use again
+	uint64_t m_tag_deadline; //stop waiting for an rx_freq tag once we get this far
+	double m_tuned_freq; //frequency the source actually reported after the last retune
+	bool m_retuned; //a dwell finished and the source was moved in this work call
+	bool m_waiting_for_tag; //the source tags retunes and the one for m_tuned_freq hasn't arrived yet
+	bool m_have_freq_tags; //we have seen rx_freq tags from this source
+	zoom_stage m_zoom; //shift + decimate for zoomed dwells
+	tuning_control m_control;
+	dwell_finalizer m_finalizer;
+	spectrum_publisher_sptr m_publisher;
+	unsigned int m_device;
+	log_db_fn m_log_db;
+	std::vector<float> m_bands; //the dwell being published, in dB, lowest frequency first
+	std::vector<double> m_resolutions;
+	std::vector<spectrum_level> m_levels; //m_bands at m_resolutions
+	std::vector<float> m_merge_centres; //where MergeLevels' bins are, in bins
+	std::map<std::pair<double, double>, std::vector<double> > m_axes; //frequency axes by centre and span
+	std::vector<double> m_axis_scratch; //for axes that don't fit into m_axes
+	welford_batch_fn m_welford;
+	bool m_adaptive;
+	unsigned int m_min_avg_size; //adaptive dwells average at least this many FFTs
+	unsigned int m_next_check; //m_count at which we next test for convergence
+	float m_tolerance_ratio;
+	std::vector<float> m_mean; //per-bin running mean of the dwell (adaptive mode)
+	std::vector<float> m_m2; //per-bin sum of squared deviations from m_mean (adaptive mode)
+	scan_stats_sptr m_timing;
+	uint64_t m_dwell_begin; //scan_stats_now() when the source got to this dwell
+	uint64_t m_capture_begin; //first usable sample of this dwell, 0 until then
+	uint64_t m_work_begin; //start of the current general_work's processing
+	uint64_t m_average_time; //ns spent processing this dwell's samples so far
+	iq_recorder_sptr m_recorder; //NULL unless recording
+	double m_last_gain; //gain of the dwell finished last
+	gain_memory_sptr m_gains; //NULL without AGC or gain memory
+	unsigned int m_converge_vectors; //vectors of this dwell up to the AGC's last gain step
+	bool m_detect;
+	signal_detector m_detector;
+	std::vector<signal_event> m_events; //found in the dwell being published
+	float m_noise_floor; //of the dwell being published, dB
+	std::vector<float> m_kurtosis; //spectral kurtosis of the dwell being published, lowest frequency first
+	std::vector<float> m_duty; //fraction of its FFTs every bin was above the duty cycle level
+	std::vector<float> m_max_hold; //max-hold of the dwell being published in dB, lowest frequency first
+	std::vector<float> m_min_hold; //min-hold
+	spectrum_persistence m_published_persistence; //the dwell being published, run-length coded
+	static const unsigned int check_interval = 16; //FFTs between convergence checks
 	double agc_power_level;
 	double agc_threshold_low;
 	double agc_threshold_high;
 	double current_gain_RF;
 	double current_gain_IF;
 	double rf_gain_mod;
-	
-	uint8_t *shared_memory; //memory shared with external monitor
-	double last_log_out;
 	int gain_change_timeout;
 };
 
 /* Shared pointer thing gnuradio is fond of */
 typedef boost::shared_ptr<scanner_sink> scanner_sink_sptr;
-scanner_sink_sptr make_scanner_sink(osmosdr::source::sptr source, unsigned int vector_length, double start_freq, double end_freq, double samples_per_second,double step, unsigned int avg_size, double def_gain, int use_AGC)
+scanner_sink_sptr make_scanner_sink(scan_source_sptr source, spectrum_pool_sptr pool, unsigned int vector_length, sweep_plan_sptr plan, const sweep_dwell &start, double def_gain, spectrum_publisher_sptr publisher, unsigned int device, scan_stats_sptr stats, iq_recorder_sptr recorder, gain_memory_sptr gains, const scan_options &options)
 {
-	return boost::shared_ptr<scanner_sink>(new scanner_sink(source, vector_length, start_freq, end_freq, samples_per_second, step, avg_size, def_gain, use_AGC));
+	return boost::shared_ptr<scanner_sink>(new scanner_sink(source, pool, vector_length, plan, start, def_gain, publisher, device, stats, recorder, gains, options));
 }
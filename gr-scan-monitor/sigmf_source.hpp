@@ -0,0 +1,231 @@
+/*
+	gr-scan - A GNU Radio signal scanner
+	Copyright (C) 2015 Jason A. Donenfeld <Jason@zx2c4.com>. All Rights Reserved.
+	Copyright (C) 2012  Nicholas Tomlinson
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef SIGMF_SOURCE_HPP
+#define SIGMF_SOURCE_HPP
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <algorithm>
+#include <cmath>
+#include <map>
+#include <string>
+#include <vector>
+
+#include <boost/shared_ptr.hpp>
+#include <boost/thread.hpp>
+
+#include <gnuradio/sync_block.h>
+#include <gnuradio/io_signature.h>
+#include <pmt/pmt.h>
+
+/* Plays iq_recorder's SigMF recordings back into the scanner. Retuning picks the
+ * next recorded dwell at that LO (so repeated sweeps advance through the recording)
+ * and loops its samples until the next retune; LOs that were never recorded give
+ * silence. There is no throttle, so replay runs as fast as the pipeline can go. */
+class sigmf_source : public gr::sync_block
+{
+public:
+	/* path is a .sigmf-meta file or a directory of them */
+	sigmf_source(const std::string &path, double sample_rate) :
+		gr::sync_block("sigmf_source",
+			gr::io_signature::make(0, 0, 0),
+			gr::io_signature::make(1, 1, sizeof(gr_complex))),
+		m_count(0),
+		m_playing(NULL),
+		m_length(0),
+		m_pos(0),
+		m_lo(0.0),
+		m_retuned(true),
+		m_rx_freq_key(pmt::intern("rx_freq"))
+	{
+		std::vector<std::string> metas;
+		DIR *dir = opendir(path.c_str());
+		if (dir)
+		{
+			while (dirent *entry = readdir(dir))
+			{
+				std::string name(entry->d_name);
+				if (name.size() > 11 && name.compare(name.size() - 11, 11, ".sigmf-meta") == 0)
+					metas.push_back(path + "/" + name);
+			}
+			closedir(dir);
+			std::sort(metas.begin(), metas.end()); //names start with the time, so this is recording order
+		}
+		else
+			metas.push_back(path);
+
+		for (size_t i = 0; i < metas.size(); ++i)
+			Load(metas[i], sample_rate);
+		printf("[*] replaying %u dwells at %u frequencies from %s\n", static_cast<unsigned int>(m_count), static_cast<unsigned int>(m_dwells.size()), path.c_str());
+	}
+
+	~sigmf_source()
+	{
+		for (size_t i = 0; i < m_maps.size(); ++i)
+			munmap(m_maps[i].first, m_maps[i].second);
+	}
+
+	double set_center_freq(double freq)
+	{
+		boost::lock_guard<boost::mutex> lock(m_mutex);
+		m_lo = freq;
+		m_retuned = true;
+		m_playing = NULL;
+		m_length = 0;
+		m_pos = 0;
+		std::map<int64_t, lo_dwells>::iterator it = m_dwells.find(Key(freq));
+		if (it != m_dwells.end())
+		{
+			lo_dwells &d = it->second;
+			m_playing = d.samples[d.next];
+			m_length = d.counts[d.next];
+			d.next = (d.next + 1) % d.samples.size();
+		}
+		return freq;
+	}
+
+	double set_gain(double gain) { return gain; } //the recording has whatever gain it was taken with
+	double set_gain(double gain, const std::string &name) { return gain; }
+	double get_gain(const std::string &name) { return 0.0; }
+
+	int work(int noutput_items, gr_vector_const_void_star &input_items, gr_vector_void_star &output_items)
+	{
+		gr_complex *out = static_cast<gr_complex *>(output_items[0]);
+		boost::lock_guard<boost::mutex> lock(m_mutex);
+		if (m_retuned)
+		{
+			add_item_tag(0, nitems_written(0), m_rx_freq_key, pmt::from_double(m_lo));
+			m_retuned = false;
+		}
+		if (!m_playing)
+		{
+			std::fill(out, out + noutput_items, gr_complex(0.0f, 0.0f));
+			return noutput_items;
+		}
+		for (int done = 0; done < noutput_items;)
+		{
+			size_t chunk = std::min<size_t>(noutput_items - done, m_length - m_pos);
+			memcpy(out + done, m_playing + m_pos, chunk * sizeof(gr_complex));
+			done += chunk;
+			m_pos = (m_pos + chunk) % m_length;
+		}
+		return noutput_items;
+	}
+
+private:
+	struct lo_dwells
+	{
+		lo_dwells() : next(0) {}
+		std::vector<const gr_complex *> samples;
+		std::vector<uint64_t> counts;
+		size_t next; //played at the next retune to this LO
+	};
+
+	static int64_t Key(double freq)
+	{
+		return static_cast<int64_t>(floor(freq / 100.0 + 0.5)); //the sweep retunes to the same LOs every pass, to well within 100 Hz
+	}
+
+	static bool Number(const char *line, const char *key, double &value)
+	{
+		const char *p = strstr(line, key);
+		return p && sscanf(p + strlen(key), " : %lf", &value) == 1;
+	}
+
+	/* Reads the lines iq_recorder writes: one capture or annotation each */
+	void Load(const std::string &meta, double sample_rate)
+	{
+		FILE *in = fopen(meta.c_str(), "r");
+		if (!in)
+		{
+			fprintf(stderr, "[!] can't read %s\n", meta.c_str());
+			return;
+		}
+		std::string data = meta.substr(0, meta.size() - 4) + "data";
+		int fd = open(data.c_str(), O_RDONLY);
+		struct stat st;
+		if (fd < 0 || fstat(fd, &st) != 0 || st.st_size == 0)
+		{
+			fprintf(stderr, "[!] can't read %s\n", data.c_str());
+			if (fd >= 0)
+				close(fd);
+			fclose(in);
+			return;
+		}
+		void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		close(fd);
+		if (map == MAP_FAILED)
+		{
+			fprintf(stderr, "[!] can't map %s\n", data.c_str());
+			fclose(in);
+			return;
+		}
+		m_maps.push_back(std::make_pair(map, static_cast<size_t>(st.st_size)));
+		const gr_complex *samples = static_cast<const gr_complex *>(map);
+		const uint64_t total = st.st_size / sizeof(gr_complex);
+
+		std::map<uint64_t, double> lo_at; //capture start -> LO
+		char line[4096];
+		while (fgets(line, sizeof(line), in))
+		{
+			double rate, start, count, lo;
+			if (Number(line, "\"core:sample_rate\"", rate) && fabs(rate - sample_rate) > 1.0)
+				fprintf(stderr, "[!] %s was recorded at %g Msps, not %g\n", meta.c_str(), rate / 1000000.0, sample_rate / 1000000.0);
+			if (!Number(line, "\"core:sample_start\"", start))
+				continue;
+			if (Number(line, "\"core:frequency\"", lo))
+				lo_at[static_cast<uint64_t>(start)] = lo;
+			else if (Number(line, "\"core:sample_count\"", count) && count > 0 && start + count <= total)
+			{
+				std::map<uint64_t, double>::const_iterator it = lo_at.find(static_cast<uint64_t>(start));
+				if (it == lo_at.end())
+					continue;
+				lo_dwells &d = m_dwells[Key(it->second)];
+				d.samples.push_back(samples + static_cast<uint64_t>(start));
+				d.counts.push_back(static_cast<uint64_t>(count));
+				++m_count;
+			}
+		}
+		fclose(in);
+	}
+
+	std::map<int64_t, lo_dwells> m_dwells; //by LO in 100 Hz steps
+	std::vector<std::pair<void *, size_t> > m_maps;
+	size_t m_count; //dwells loaded
+	const gr_complex *m_playing; //dwell being looped, NULL for silence
+	uint64_t m_length;
+	uint64_t m_pos;
+	double m_lo;
+	bool m_retuned;
+	pmt::pmt_t m_rx_freq_key;
+	boost::mutex m_mutex;
+};
+
+typedef boost::shared_ptr<sigmf_source> sigmf_source_sptr;
+
+#endif
@@ -0,0 +1,114 @@
+/*
+	gr-scan - A GNU Radio signal scanner
+	Copyright (C) 2015 Jason A. Donenfeld <Jason@zx2c4.com>. All Rights Reserved.
+	Copyright (C) 2012  Nicholas Tomlinson
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef SIGNAL_DETECTOR_HPP
+#define SIGNAL_DETECTOR_HPP
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+/* One signal found in a dwell */
+struct signal_event
+{
+	double centre; //Hz, weighted by linear power
+	float bandwidth; //Hz covered by the bins above the threshold
+	float peak; //dB
+	float snr; //peak above the noise floor, dB
+};
+
+/* Finds the signals in a dwell of bins in dB (lowest frequency first, bin i centred
+ * on low + i * width Hz) the way gr-scan's "Found signal" did, but
+ * against an estimate of the noise instead of a smoothed copy of the spectrum:
+ *
+ *  - the noise floor is the median of the bins in [begin, end) outside [skip_begin,
+ *    skip_end) (the DC spike); signals rarely cover half a dwell, so it sits on the
+ *    noise however strong they are
+ *  - every bin threshold dB or more above it is part of a signal, and runs of them
+ *    no more than max_gap bins apart are one signal (a carrier's skirts dip below
+ *    the threshold between its sidebands)
+ *
+ * Returns the noise floor; events gets one entry per signal, lowest first. */
+class signal_detector
+{
+public:
+	signal_detector(float threshold) :
+		m_threshold(threshold)
+	{
+	}
+
+	float Detect(const float *bands, unsigned int begin, unsigned int end, unsigned int skip_begin,
+		unsigned int skip_end, double low, double width, std::vector<signal_event> &events)
+	{
+		events.clear();
+		m_scratch.clear();
+		for (unsigned int i = begin; i < end; ++i)
+			if (i < skip_begin || i >= skip_end)
+				m_scratch.push_back(bands[i]);
+		if (m_scratch.empty())
+			return 0.0f;
+		std::nth_element(m_scratch.begin(), m_scratch.begin() + m_scratch.size() / 2, m_scratch.end());
+		const float floor = m_scratch[m_scratch.size() / 2];
+		const float level = floor + m_threshold;
+
+		unsigned int first = 0, last = 0, gap = 0;
+		bool open = false;
+		double power = 0.0, moment = 0.0;
+		float peak = 0.0f;
+		for (unsigned int i = begin; i <= end; ++i)
+		{
+			bool above = i < end && (i < skip_begin || i >= skip_end) && bands[i] >= level;
+			if (above)
+			{
+				if (!open)
+				{
+					open = true;
+					first = i;
+					power = moment = 0.0;
+					peak = bands[i];
+				}
+				last = i;
+				gap = 0;
+				double linear = pow(10.0, (bands[i] - floor) / 10.0); //relative to the floor, so it stays in range
+				power += linear;
+				moment += linear * (low + i * width); //in double, a float axis is 512 Hz coarse at 5.8 GHz
+				peak = std::max(peak, bands[i]);
+			}
+			else if (open && (++gap > max_gap || i == end))
+			{
+				signal_event event;
+				event.centre = moment / power;
+				event.bandwidth = (last - first + 1) * width;
+				event.peak = peak;
+				event.snr = peak - floor;
+				events.push_back(event);
+				open = false;
+			}
+		}
+		return floor;
+	}
+
+private:
+	static const unsigned int max_gap = 2; //bins below the threshold that still don't split a signal
+
+	float m_threshold; //dB above the noise floor
+	std::vector<float> m_scratch; //for the median
+};
+
+#endif
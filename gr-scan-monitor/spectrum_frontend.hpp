@@ -0,0 +1,224 @@
+/*
+	gr-scan - A GNU Radio signal scanner
+	Copyright (C) 2015 Jason A. Donenfeld <Jason@zx2c4.com>. All Rights Reserved.
+	Copyright (C) 2012  Nicholas Tomlinson
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef SPECTRUM_FRONTEND_HPP
+#define SPECTRUM_FRONTEND_HPP
+
+#include <cmath>
+#include <stdint.h>
+#include <string.h>
+#include <vector>
+
+#include <boost/shared_ptr.hpp>
+
+#include <gnuradio/fft/fft.h>
+#include <volk/volk.h>
+
+#include "spectrum_kernels.hpp"
+
+/* Turns blocks of complex samples into power spectra: window, forward FFT and |X|^2.
+ * This is the work stream_to_vector -> fft_vcc -> complex_to_mag_squared used to do,
+ * made with the same volk kernels and FFTW plan so the output is bit for bit the
+ * same, but without pushing every vector through two extra GNU Radio buffers.
+ *
+ * Consecutive FFTs start hop samples apart. With hop < vector_length the segments
+ * overlap (Welch's method): a windowed segment only uses its middle samples fully,
+ * so overlapping them gets nearly the variance reduction of independent FFTs from
+ * far fewer captured samples.
+ *
+ * A window taps times longer than vector_length turns this into a polyphase
+ * filterbank: taps * vector_length samples are weighted with a windowed sinc and
+ * folded onto vector_length points before the FFT. Every bin then has a nearly
+ * flat passband one bin wide and steep skirts, so a strong signal no longer leaks
+ * into bins far away and bins close to the band edges can be used. With hop =
+ * vector_length the filterbank is critically sampled, hop = vector_length / 2
+ * oversamples it 2x. */
+class spectrum_frontend
+{
+public:
+	spectrum_frontend(unsigned int vector_length, const std::vector<float> &window, unsigned int hop = 0) :
+		m_vector_length(vector_length),
+		m_hop(hop > 0 && hop < vector_length ? hop : vector_length),
+		m_taps(window.size() > vector_length ? window.size() / vector_length : 1),
+		m_window(window),
+		m_window_int8(select_window_int8()),
+		m_fft(vector_length, true, 1)
+	{
+		if (m_taps > 1)
+		{
+			m_window.resize(m_taps * vector_length);
+			m_folded.resize(m_taps * vector_length);
+		}
+		m_window8.resize(2 * span(), int8_scale()); //I and Q weighted alike
+		for (size_t i = 0; i < m_window.size(); ++i)
+			m_window8[2 * i] = m_window8[2 * i + 1] = m_window[i] * int8_scale();
+	}
+
+	/* The same window and hop with an FFT plan and buffers of its own: Transform
+	 * uses the object's buffers, so threads can't share one frontend */
+	spectrum_frontend *Clone() const
+	{
+		return new spectrum_frontend(m_vector_length, m_window, m_hop);
+	}
+
+	unsigned int vector_length() const
+	{
+		return m_vector_length;
+	}
+
+	unsigned int hop() const
+	{
+		return m_hop;
+	}
+
+	/* Samples one Transform reads */
+	unsigned int span() const
+	{
+		return m_taps * m_vector_length;
+	}
+
+	/* Bins at each end of the spectrum that leakage and the filter skirts make
+	 * unreliable; whoever displays the spectra should leave them out */
+	unsigned int EdgeBins() const
+	{
+		return m_taps > 1 ? m_vector_length / 10 : m_vector_length / 4;
+	}
+
+	/* Fraction of the captured bandwidth left after dropping EdgeBins on both sides */
+	static double UsableFraction(bool pfb)
+	{
+		return pfb ? 0.8 : 0.5;
+	}
+
+	/* Number of samples between FFT starts for the given overlap in percent */
+	static unsigned int GetHop(unsigned int vector_length, double overlap)
+	{
+		if (overlap <= 0.0 || overlap >= 100.0)
+			return vector_length;
+		unsigned int hop = static_cast<unsigned int>(vector_length * (1.0 - overlap / 100.0) + 0.5);
+		return hop > 0 ? hop : 1;
+	}
+
+	/* Number of whole FFTs that fit into count samples */
+	unsigned int VectorsIn(unsigned int count) const
+	{
+		return count < span() ? 0 : (count - span()) / m_hop + 1;
+	}
+
+	/* http://en.wikipedia.org/w/index.php?title=Window_function&oldid=508445914 */
+	static std::vector<float> GetWindow(size_t n)
+	{
+		std::vector<float> w;
+		w.resize(n);
+
+		double a = 0.16;
+		double a0 = (1.0 - a)/2.0;
+		double a1 = 0.5;
+		double a2 = a/2.0;
+
+		for (unsigned int i = 0; i < n; ++i)
+			w[i] = a0 - a1 * ::cos((2.0 * 3.14159 * static_cast<double>(i))/static_cast<double>(n - 1)) + a2 * ::cos((4.0 * 3.14159 * static_cast<double>(i))/static_cast<double>(n - 1));
+		return w;
+	}
+
+	/* Polyphase filterbank prototype: a sinc over taps * n samples, shaped by the same
+	 * window. The passband is made 1.3 bins wide so neighbouring bins cross over
+	 * high up (under 1 dB of scalloping with 8 taps instead of 6 dB for exactly one
+	 * bin). Scaled to the noise gain of GetWindow(n), so noise floors read the same
+	 * with and without the filterbank. */
+	static std::vector<float> GetPfbWindow(size_t n, unsigned int taps)
+	{
+		std::vector<float> w = GetWindow(taps * n);
+		double centre = (taps * n - 1) / 2.0;
+		double power = 0.0;
+		for (size_t i = 0; i < w.size(); ++i)
+		{
+			double x = 1.3 * (i - centre) / n;
+			w[i] *= x == 0.0 ? 1.0 : sin(M_PI * x) / (M_PI * x);
+			power += static_cast<double>(w[i]) * w[i];
+		}
+
+		std::vector<float> plain = GetWindow(n);
+		double plain_power = 0.0;
+		for (size_t i = 0; i < n; ++i)
+			plain_power += static_cast<double>(plain[i]) * plain[i];
+		float scale = sqrt(plain_power / power);
+		for (size_t i = 0; i < w.size(); ++i)
+			w[i] *= scale;
+		return w;
+	}
+
+	/* Writes the power spectrum of the span() samples at input into output */
+	void Transform(const gr_complex *input, float *output)
+	{
+		gr_complex *fft_in = m_fft.get_inbuf();
+		if (m_taps > 1) //weight all taps, then fold them onto one FFT input
+		{
+			volk_32fc_32f_multiply_32fc(&m_folded[0], input, &m_window[0], span());
+			Fold(fft_in);
+		}
+		else if (m_window.empty())
+			memcpy(fft_in, input, sizeof(gr_complex) * m_vector_length);
+		else
+			volk_32fc_32f_multiply_32fc(fft_in, input, &m_window[0], m_vector_length);
+		m_fft.execute();
+		volk_32fc_magnitude_squared_32f(output, m_fft.get_outbuf(), m_vector_length);
+	}
+
+	static float int8_scale() { return 1.0f / 128.0f; } //what osmosdr scales HackRF samples by, so levels don't change
+
+	/* The same for span() interleaved int8 I/Q pairs: they are converted and
+	 * windowed in one pass straight into the FFT input (or the taps to fold) */
+	void Transform(const int8_t *input, float *output)
+	{
+		gr_complex *fft_in = m_fft.get_inbuf();
+		if (m_taps > 1)
+		{
+			m_window_int8(reinterpret_cast<float *>(&m_folded[0]), input, &m_window8[0], span());
+			Fold(fft_in);
+		}
+		else
+			m_window_int8(reinterpret_cast<float *>(fft_in), input, &m_window8[0], m_vector_length);
+		m_fft.execute();
+		volk_32fc_magnitude_squared_32f(output, m_fft.get_outbuf(), m_vector_length);
+	}
+
+private:
+	/* Sums the weighted taps in m_folded onto the FFT input */
+	void Fold(gr_complex *fft_in)
+	{
+		memcpy(fft_in, &m_folded[0], sizeof(gr_complex) * m_vector_length);
+		for (unsigned int t = 1; t < m_taps; ++t)
+			volk_32f_x2_add_32f(reinterpret_cast<float *>(fft_in), reinterpret_cast<const float *>(fft_in),
+				reinterpret_cast<const float *>(&m_folded[t * m_vector_length]), 2 * m_vector_length);
+	}
+
+	unsigned int m_vector_length;
+	unsigned int m_hop;
+	unsigned int m_taps; //filterbank taps per bin, 1 for a plain windowed FFT
+	std::vector<float> m_window;
+	std::vector<gr_complex> m_folded; //weighted samples before folding
+	std::vector<float> m_window8; //m_window for interleaved int8 I/Q, scale included
+	window_int8_fn m_window_int8;
+	gr::fft::fft_complex m_fft;
+};
+
+typedef boost::shared_ptr<spectrum_frontend> spectrum_frontend_sptr;
+
+#endif
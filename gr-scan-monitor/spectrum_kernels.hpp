@@ -0,0 +1,798 @@
+/*
+	gr-scan - A GNU Radio signal scanner
+	Copyright (C) 2015 Jason A. Donenfeld <Jason@zx2c4.com>. All Rights Reserved.
+	Copyright (C) 2012  Nicholas Tomlinson
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef SPECTRUM_KERNELS_HPP
+#define SPECTRUM_KERNELS_HPP
+
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__x86_64__)
+#define SPECTRUM_KERNELS_X86 1
+#include <immintrin.h>
+#endif
+
+/* Statistics of one FFT vector, taken over the inner bins only (the outer
+ * bins on each side are filter roll-off and would skew the AGC) */
+struct vector_stats
+{
+	float sum; //sum of the inner bins
+	float max; //largest inner bin
+	float top_sum; //sum of the inner bins above the threshold
+	float top_count; //number of inner bins above the threshold
+};
+
+/* Per-bin statistics kept next to the sum when asked for. Spectral kurtosis
+ * needs the sum of the squared powers as well as the sum of the powers: they
+ * are the 2nd and 4th moments of the bin's complex amplitude, whose odd moments
+ * are zero. The duty cycle counts the vectors in which a bin was above the
+ * crossing level, ratio times the noise of the vector before (the mean of its
+ * inner bins below their mean, so a few strong bins don't pull it up). */
+struct bin_moments
+{
+	float *squares; //sum of the squared power of every bin
+	float *crossings; //number of vectors in which every bin was above the level
+	float ratio; //crossing level over the noise, linear
+	float level; //crossing level for the next vector, carried from batch to batch; FLT_MAX at a dwell's start
+};
+
+/* Largest and smallest power of every bin over the dwell so far */
+struct bin_hold
+{
+	float *max;
+	float *min;
+};
+
+/* What an accumulation kernel keeps besides the sum and the vector_stats */
+enum
+{
+	ACCUMULATE_MOMENTS = 1, //bin_moments
+	ACCUMULATE_HOLD = 2 //bin_hold
+};
+
+/* Adds every bin of each input vector into acc and fills one vector_stats per
+ * vector, all in a single pass over the input. The bins in [begin, end) are the
+ * inner ones, everything outside is only accumulated. Kernels made with
+ * ACCUMULATE_MOMENTS or ACCUMULATE_HOLD update *moments or *hold in the same
+ * pass, the others ignore them.
+ *
+ * The above-mean average needs the mean before the pass starts, so each vector
+ * is split against the mean of the vector before it (*threshold carries that
+ * mean from one batch to the next). Consecutive FFTs at one frequency have
+ * nearly the same mean and the AGC low-passes the result anyway. */
+typedef void (*accumulate_batch_fn)(float *acc, const float *input, unsigned int count, unsigned int length,
+	unsigned int begin, unsigned int end, float *threshold, vector_stats *stats, bin_moments *moments, bin_hold *hold);
+
+/* Mean of the inner bins at or below the mean, from the statistics of a vector */
+static inline float vector_noise(float sum, float top_sum, float top_count, unsigned int bins)
+{
+	return top_count < bins ? (sum - top_sum) / (bins - top_count) : sum / bins;
+}
+
+/* The per-bin outputs of one kernel call, NULL where not kept */
+struct bin_outputs
+{
+	float *acc;
+	float *squares;
+	float *crossings;
+	float *max;
+	float *min;
+};
+
+template <unsigned int extras>
+static inline bin_outputs accumulate_outputs(float *acc, bin_moments *moments, bin_hold *hold)
+{
+	bin_outputs out = {acc, NULL, NULL, NULL, NULL};
+	if (extras & ACCUMULATE_MOMENTS)
+	{
+		out.squares = moments->squares;
+		out.crossings = moments->crossings;
+	}
+	if (extras & ACCUMULATE_HOLD)
+	{
+		out.max = hold->max;
+		out.min = hold->min;
+	}
+	return out;
+}
+
+template <unsigned int extras>
+static inline void accumulate_bin(const bin_outputs &out, const float *input, unsigned int i, float level)
+{
+	const float x = input[i];
+	out.acc[i] += x;
+	if (extras & ACCUMULATE_MOMENTS)
+	{
+		out.squares[i] += x * x;
+		out.crossings[i] += x > level ? 1.0f : 0.0f;
+	}
+	if (extras & ACCUMULATE_HOLD)
+	{
+		out.max[i] = x > out.max[i] ? x : out.max[i];
+		out.min[i] = x < out.min[i] ? x : out.min[i];
+	}
+}
+
+template <unsigned int extras>
+static inline void accumulate_edges(const bin_outputs &out, const float *input, unsigned int length,
+	unsigned int begin, unsigned int end, float level)
+{
+	for (unsigned int i = 0; i < begin; ++i)
+		accumulate_bin<extras>(out, input, i, level);
+	for (unsigned int i = end; i < length; ++i)
+		accumulate_bin<extras>(out, input, i, level);
+}
+
+template <unsigned int extras>
+static inline void accumulate_batch_scalar(float *acc, const float *input, unsigned int count, unsigned int length,
+	unsigned int begin, unsigned int end, float *threshold, vector_stats *stats, bin_moments *moments, bin_hold *hold)
+{
+	const bin_outputs out = accumulate_outputs<extras>(acc, moments, hold);
+	for (unsigned int v = 0; v < count; ++v, input += length)
+	{
+		const float t = *threshold;
+		const float level = extras & ACCUMULATE_MOMENTS ? moments->level : 0.0f;
+		float sum = 0, max = -100, top_sum = 0, top_count = 0;
+		accumulate_edges<extras>(out, input, length, begin, end, level);
+		for (unsigned int i = begin; i < end; ++i)
+		{
+			const float x = input[i];
+			accumulate_bin<extras>(out, input, i, level);
+			sum += x;
+			max = x > max ? x : max;
+			const float above = x > t ? 1.0f : 0.0f;
+			top_sum += x * above;
+			top_count += above;
+		}
+		stats[v].sum = sum;
+		stats[v].max = max;
+		stats[v].top_sum = top_sum;
+		stats[v].top_count = top_count;
+		*threshold = sum / static_cast<float>(end - begin);
+		if (extras & ACCUMULATE_MOMENTS)
+			moments->level = moments->ratio * vector_noise(sum, top_sum, top_count, end - begin);
+	}
+}
+
+#ifdef SPECTRUM_KERNELS_X86
+static inline float hsum_ps(__m128 v)
+{
+	v = _mm_add_ps(v, _mm_movehl_ps(v, v));
+	v = _mm_add_ss(v, _mm_shuffle_ps(v, v, 1));
+	return _mm_cvtss_f32(v);
+}
+
+static inline float hmax_ps(__m128 v)
+{
+	v = _mm_max_ps(v, _mm_movehl_ps(v, v));
+	v = _mm_max_ss(v, _mm_shuffle_ps(v, v, 1));
+	return _mm_cvtss_f32(v);
+}
+
+template <unsigned int extras>
+static inline void accumulate_batch_sse(float *acc, const float *input, unsigned int count, unsigned int length,
+	unsigned int begin, unsigned int end, float *threshold, vector_stats *stats, bin_moments *moments, bin_hold *hold)
+{
+	const __m128 one = _mm_set1_ps(1.0f);
+	const bin_outputs out = accumulate_outputs<extras>(acc, moments, hold);
+	for (unsigned int v = 0; v < count; ++v, input += length)
+	{
+		const float t = *threshold;
+		const __m128 vt = _mm_set1_ps(t);
+		const float level = extras & ACCUMULATE_MOMENTS ? moments->level : 0.0f;
+		const __m128 vlevel = _mm_set1_ps(level);
+		__m128 sum = _mm_setzero_ps(), max = _mm_set1_ps(-100), top_sum = _mm_setzero_ps(), top_count = _mm_setzero_ps();
+		accumulate_edges<extras>(out, input, length, begin, end, level);
+		unsigned int i = begin;
+		for (; i + 4 <= end; i += 4)
+		{
+			const __m128 x = _mm_loadu_ps(input + i);
+			_mm_storeu_ps(out.acc + i, _mm_add_ps(_mm_loadu_ps(out.acc + i), x));
+			if (extras & ACCUMULATE_MOMENTS)
+			{
+				_mm_storeu_ps(out.squares + i, _mm_add_ps(_mm_loadu_ps(out.squares + i), _mm_mul_ps(x, x)));
+				_mm_storeu_ps(out.crossings + i, _mm_add_ps(_mm_loadu_ps(out.crossings + i), _mm_and_ps(_mm_cmpgt_ps(x, vlevel), one)));
+			}
+			if (extras & ACCUMULATE_HOLD)
+			{
+				_mm_storeu_ps(out.max + i, _mm_max_ps(_mm_loadu_ps(out.max + i), x));
+				_mm_storeu_ps(out.min + i, _mm_min_ps(_mm_loadu_ps(out.min + i), x));
+			}
+			sum = _mm_add_ps(sum, x);
+			max = _mm_max_ps(max, x);
+			const __m128 above = _mm_cmpgt_ps(x, vt);
+			top_sum = _mm_add_ps(top_sum, _mm_and_ps(above, x));
+			top_count = _mm_add_ps(top_count, _mm_and_ps(above, one));
+		}
+		float s = hsum_ps(sum), m = hmax_ps(max), ts = hsum_ps(top_sum), tc = hsum_ps(top_count);
+		for (; i < end; ++i)
+		{
+			const float x = input[i];
+			accumulate_bin<extras>(out, input, i, level);
+			s += x;
+			m = x > m ? x : m;
+			if (x > t) { ts += x; tc += 1.0f; }
+		}
+		stats[v].sum = s;
+		stats[v].max = m;
+		stats[v].top_sum = ts;
+		stats[v].top_count = tc;
+		*threshold = s / static_cast<float>(end - begin);
+		if (extras & ACCUMULATE_MOMENTS)
+			moments->level = moments->ratio * vector_noise(s, ts, tc, end - begin);
+	}
+}
+
+template <unsigned int extras>
+__attribute__((target("avx2")))
+static inline void accumulate_batch_avx2(float *acc, const float *input, unsigned int count, unsigned int length,
+	unsigned int begin, unsigned int end, float *threshold, vector_stats *stats, bin_moments *moments, bin_hold *hold)
+{
+	const __m256 one = _mm256_set1_ps(1.0f);
+	const bin_outputs out = accumulate_outputs<extras>(acc, moments, hold);
+	for (unsigned int v = 0; v < count; ++v, input += length)
+	{
+		const float t = *threshold;
+		const __m256 vt = _mm256_set1_ps(t);
+		const float level = extras & ACCUMULATE_MOMENTS ? moments->level : 0.0f;
+		const __m256 vlevel = _mm256_set1_ps(level);
+		__m256 sum = _mm256_setzero_ps(), max = _mm256_set1_ps(-100), top_sum = _mm256_setzero_ps(), top_count = _mm256_setzero_ps();
+		accumulate_edges<extras>(out, input, length, begin, end, level);
+		unsigned int i = begin;
+		for (; i + 8 <= end; i += 8)
+		{
+			const __m256 x = _mm256_loadu_ps(input + i);
+			_mm256_storeu_ps(out.acc + i, _mm256_add_ps(_mm256_loadu_ps(out.acc + i), x));
+			if (extras & ACCUMULATE_MOMENTS)
+			{
+				_mm256_storeu_ps(out.squares + i, _mm256_add_ps(_mm256_loadu_ps(out.squares + i), _mm256_mul_ps(x, x)));
+				_mm256_storeu_ps(out.crossings + i, _mm256_add_ps(_mm256_loadu_ps(out.crossings + i),
+					_mm256_and_ps(_mm256_cmp_ps(x, vlevel, _CMP_GT_OQ), one)));
+			}
+			if (extras & ACCUMULATE_HOLD)
+			{
+				_mm256_storeu_ps(out.max + i, _mm256_max_ps(_mm256_loadu_ps(out.max + i), x));
+				_mm256_storeu_ps(out.min + i, _mm256_min_ps(_mm256_loadu_ps(out.min + i), x));
+			}
+			sum = _mm256_add_ps(sum, x);
+			max = _mm256_max_ps(max, x);
+			const __m256 above = _mm256_cmp_ps(x, vt, _CMP_GT_OQ);
+			top_sum = _mm256_add_ps(top_sum, _mm256_and_ps(above, x));
+			top_count = _mm256_add_ps(top_count, _mm256_and_ps(above, one));
+		}
+		float s = hsum_ps(_mm_add_ps(_mm256_castps256_ps128(sum), _mm256_extractf128_ps(sum, 1)));
+		float m = hmax_ps(_mm_max_ps(_mm256_castps256_ps128(max), _mm256_extractf128_ps(max, 1)));
+		float ts = hsum_ps(_mm_add_ps(_mm256_castps256_ps128(top_sum), _mm256_extractf128_ps(top_sum, 1)));
+		float tc = hsum_ps(_mm_add_ps(_mm256_castps256_ps128(top_count), _mm256_extractf128_ps(top_count, 1)));
+		for (; i < end; ++i)
+		{
+			const float x = input[i];
+			accumulate_bin<extras>(out, input, i, level);
+			s += x;
+			m = x > m ? x : m;
+			if (x > t) { ts += x; tc += 1.0f; }
+		}
+		stats[v].sum = s;
+		stats[v].max = m;
+		stats[v].top_sum = ts;
+		stats[v].top_count = tc;
+		*threshold = s / static_cast<float>(end - begin);
+		if (extras & ACCUMULATE_MOMENTS)
+			moments->level = moments->ratio * vector_noise(s, ts, tc, end - begin);
+	}
+}
+#endif
+
+/* Welford update of the per-bin running mean and sum of squared deviations (m2)
+ * with count more vectors, n being the number of vectors already taken in */
+typedef void (*welford_batch_fn)(float *mean, float *m2, const float *input, unsigned int count, unsigned int length, unsigned int n);
+
+static inline void welford_batch_scalar(float *mean, float *m2, const float *input, unsigned int count, unsigned int length, unsigned int n)
+{
+	for (unsigned int v = 0; v < count; ++v, input += length)
+	{
+		const float inv = 1.0f / static_cast<float>(++n);
+		for (unsigned int i = 0; i < length; ++i)
+		{
+			const float delta = input[i] - mean[i];
+			mean[i] += delta * inv;
+			m2[i] += delta * (input[i] - mean[i]);
+		}
+	}
+}
+
+#ifdef SPECTRUM_KERNELS_X86
+static inline void welford_batch_sse(float *mean, float *m2, const float *input, unsigned int count, unsigned int length, unsigned int n)
+{
+	for (unsigned int v = 0; v < count; ++v, input += length)
+	{
+		const float inv = 1.0f / static_cast<float>(++n);
+		const __m128 vinv = _mm_set1_ps(inv);
+		unsigned int i = 0;
+		for (; i + 4 <= length; i += 4)
+		{
+			const __m128 x = _mm_loadu_ps(input + i);
+			const __m128 delta = _mm_sub_ps(x, _mm_loadu_ps(mean + i));
+			const __m128 m = _mm_add_ps(_mm_loadu_ps(mean + i), _mm_mul_ps(delta, vinv));
+			_mm_storeu_ps(mean + i, m);
+			_mm_storeu_ps(m2 + i, _mm_add_ps(_mm_loadu_ps(m2 + i), _mm_mul_ps(delta, _mm_sub_ps(x, m))));
+		}
+		for (; i < length; ++i)
+		{
+			const float delta = input[i] - mean[i];
+			mean[i] += delta * inv;
+			m2[i] += delta * (input[i] - mean[i]);
+		}
+	}
+}
+
+__attribute__((target("avx2")))
+static inline void welford_batch_avx2(float *mean, float *m2, const float *input, unsigned int count, unsigned int length, unsigned int n)
+{
+	for (unsigned int v = 0; v < count; ++v, input += length)
+	{
+		const float inv = 1.0f / static_cast<float>(++n);
+		const __m256 vinv = _mm256_set1_ps(inv);
+		unsigned int i = 0;
+		for (; i + 8 <= length; i += 8)
+		{
+			const __m256 x = _mm256_loadu_ps(input + i);
+			const __m256 delta = _mm256_sub_ps(x, _mm256_loadu_ps(mean + i));
+			const __m256 m = _mm256_add_ps(_mm256_loadu_ps(mean + i), _mm256_mul_ps(delta, vinv));
+			_mm256_storeu_ps(mean + i, m);
+			_mm256_storeu_ps(m2 + i, _mm256_add_ps(_mm256_loadu_ps(m2 + i), _mm256_mul_ps(delta, _mm256_sub_ps(x, m))));
+		}
+		for (; i < length; ++i)
+		{
+			const float delta = input[i] - mean[i];
+			mean[i] += delta * inv;
+			m2[i] += delta * (input[i] - mean[i]);
+		}
+	}
+}
+#endif
+
+/* True when, for every bin in [begin, end), the z-sigma confidence interval of the
+ * mean is within a factor of (1 + ratio) of the mean, i.e. within 10*log10(1 + ratio) dB.
+ * Tested as z^2 * m2 / (n * (n - 1)) < ratio^2 * mean^2 to stay clear of sqrt and log. */
+static inline bool welford_converged(const float *mean, const float *m2, unsigned int begin, unsigned int end,
+	unsigned int n, float z, float ratio)
+{
+	if (n < 2)
+		return false;
+	const float lhs = z * z / (static_cast<float>(n) * static_cast<float>(n - 1));
+	const float rhs = ratio * ratio;
+	for (unsigned int i = begin; i < end; ++i)
+		if (lhs * m2[i] >= rhs * mean[i] * mean[i])
+			return false;
+	return true;
+}
+
+/* 10 * log10(in[i]) + offset for count bins, without libm. in = m * 2^e with m
+ * folded into [sqrt(1/2), sqrt(2)), so ln(m) = 2 atanh(t) with t = (m - 1) / (m + 1),
+ * |t| < 0.172, and four terms of the atanh series leave a truncation error below
+ * 2e-7 dB. What remains is float rounding: against 10 * log10f the result is within
+ * 1e-4 dB over all normal floats, 1e-5 dB for results under 100 dB in magnitude
+ * (measured by bench_finalize). 0 gives about -382 dB + offset instead of -inf. */
+typedef void (*log_db_fn)(float *out, const float *in, unsigned int count, float offset);
+
+#define LOG_DB_LOG2 3.01029995663981195f //10 * log10(2)
+#define LOG_DB_LN 4.34294481903251828f //10 * log10(e)
+
+static inline void log_db_scalar(float *out, const float *in, unsigned int count, float offset)
+{
+	for (unsigned int i = 0; i < count; ++i)
+	{
+		uint32_t bits;
+		memcpy(&bits, &in[i], sizeof(bits));
+		int e = static_cast<int>((bits >> 23) & 0xff) - 127;
+		bits = (bits & 0x7fffff) | 0x3f800000;
+		float m;
+		memcpy(&m, &bits, sizeof(m));
+		if (m > 1.41421356f)
+		{
+			m *= 0.5f;
+			++e;
+		}
+		const float t = (m - 1.0f) / (m + 1.0f);
+		const float t2 = t * t;
+		const float ln = 2.0f * t * (1.0f + t2 * (1.0f / 3.0f + t2 * (1.0f / 5.0f + t2 * (1.0f / 7.0f))));
+		out[i] = static_cast<float>(e) * LOG_DB_LOG2 + ln * LOG_DB_LN + offset;
+	}
+}
+
+#ifdef SPECTRUM_KERNELS_X86
+static inline void log_db_sse(float *out, const float *in, unsigned int count, float offset)
+{
+	const __m128i exponent_mask = _mm_set1_epi32(0xff), bias = _mm_set1_epi32(127);
+	const __m128i mantissa_mask = _mm_set1_epi32(0x7fffff), one_bits = _mm_set1_epi32(0x3f800000);
+	const __m128 one = _mm_set1_ps(1.0f), half = _mm_set1_ps(0.5f), sqrt2 = _mm_set1_ps(1.41421356f);
+	const __m128 c3 = _mm_set1_ps(1.0f / 3.0f), c5 = _mm_set1_ps(1.0f / 5.0f), c7 = _mm_set1_ps(1.0f / 7.0f);
+	const __m128 log2 = _mm_set1_ps(LOG_DB_LOG2), ln2 = _mm_set1_ps(2.0f * LOG_DB_LN), voffset = _mm_set1_ps(offset);
+	unsigned int i = 0;
+	for (; i + 4 <= count; i += 4)
+	{
+		const __m128i bits = _mm_castps_si128(_mm_loadu_ps(in + i));
+		__m128 e = _mm_cvtepi32_ps(_mm_sub_epi32(_mm_and_si128(_mm_srli_epi32(bits, 23), exponent_mask), bias));
+		__m128 m = _mm_castsi128_ps(_mm_or_si128(_mm_and_si128(bits, mantissa_mask), one_bits));
+		const __m128 big = _mm_cmpgt_ps(m, sqrt2);
+		m = _mm_or_ps(_mm_and_ps(big, _mm_mul_ps(m, half)), _mm_andnot_ps(big, m));
+		e = _mm_add_ps(e, _mm_and_ps(big, one));
+		const __m128 t = _mm_div_ps(_mm_sub_ps(m, one), _mm_add_ps(m, one));
+		const __m128 t2 = _mm_mul_ps(t, t);
+		__m128 p = _mm_add_ps(c5, _mm_mul_ps(t2, c7));
+		p = _mm_add_ps(c3, _mm_mul_ps(t2, p));
+		p = _mm_add_ps(one, _mm_mul_ps(t2, p));
+		const __m128 db = _mm_add_ps(_mm_mul_ps(e, log2), _mm_mul_ps(_mm_mul_ps(t, p), ln2));
+		_mm_storeu_ps(out + i, _mm_add_ps(db, voffset));
+	}
+	log_db_scalar(out + i, in + i, count - i, offset);
+}
+
+__attribute__((target("avx2")))
+static inline void log_db_avx2(float *out, const float *in, unsigned int count, float offset)
+{
+	const __m256i exponent_mask = _mm256_set1_epi32(0xff), bias = _mm256_set1_epi32(127);
+	const __m256i mantissa_mask = _mm256_set1_epi32(0x7fffff), one_bits = _mm256_set1_epi32(0x3f800000);
+	const __m256 one = _mm256_set1_ps(1.0f), half = _mm256_set1_ps(0.5f), sqrt2 = _mm256_set1_ps(1.41421356f);
+	const __m256 c3 = _mm256_set1_ps(1.0f / 3.0f), c5 = _mm256_set1_ps(1.0f / 5.0f), c7 = _mm256_set1_ps(1.0f / 7.0f);
+	const __m256 log2 = _mm256_set1_ps(LOG_DB_LOG2), ln2 = _mm256_set1_ps(2.0f * LOG_DB_LN), voffset = _mm256_set1_ps(offset);
+	unsigned int i = 0;
+	for (; i + 8 <= count; i += 8)
+	{
+		const __m256i bits = _mm256_castps_si256(_mm256_loadu_ps(in + i));
+		__m256 e = _mm256_cvtepi32_ps(_mm256_sub_epi32(_mm256_and_si256(_mm256_srli_epi32(bits, 23), exponent_mask), bias));
+		__m256 m = _mm256_castsi256_ps(_mm256_or_si256(_mm256_and_si256(bits, mantissa_mask), one_bits));
+		const __m256 big = _mm256_cmp_ps(m, sqrt2, _CMP_GT_OQ);
+		m = _mm256_blendv_ps(m, _mm256_mul_ps(m, half), big);
+		e = _mm256_add_ps(e, _mm256_and_ps(big, one));
+		const __m256 t = _mm256_div_ps(_mm256_sub_ps(m, one), _mm256_add_ps(m, one));
+		const __m256 t2 = _mm256_mul_ps(t, t);
+		__m256 p = _mm256_add_ps(c5, _mm256_mul_ps(t2, c7));
+		p = _mm256_add_ps(c3, _mm256_mul_ps(t2, p));
+		p = _mm256_add_ps(one, _mm256_mul_ps(t2, p));
+		const __m256 db = _mm256_add_ps(_mm256_mul_ps(e, log2), _mm256_mul_ps(_mm256_mul_ps(t, p), ln2));
+		_mm256_storeu_ps(out + i, _mm256_add_ps(db, voffset));
+	}
+	log_db_scalar(out + i, in + i, count - i, offset);
+}
+#endif
+
+/* The FFT input stage for 8 bit sources: count interleaved int8 I/Q pairs (what a
+ * HackRF delivers) become floats and are windowed in the same pass, so the samples
+ * only ever exist as floats in the FFT's input buffer. window has 2 * count weights,
+ * every one twice (for I and Q), with the int8 full scale folded in. */
+typedef void (*window_int8_fn)(float *out, const int8_t *in, const float *window, unsigned int count);
+
+static inline void window_int8_scalar(float *out, const int8_t *in, const float *window, unsigned int count)
+{
+	for (unsigned int i = 0; i < 2 * count; ++i)
+		out[i] = static_cast<float>(in[i]) * window[i];
+}
+
+#ifdef SPECTRUM_KERNELS_X86
+static inline void window_int8_sse(float *out, const int8_t *in, const float *window, unsigned int count)
+{
+	unsigned int i = 0;
+	for (; i + 16 <= 2 * count; i += 16)
+	{
+		/* sign extend by unpacking each byte into the top of a wider lane and shifting it back down */
+		const __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i *>(in + i));
+		const __m128i lo16 = _mm_srai_epi16(_mm_unpacklo_epi8(bytes, bytes), 8);
+		const __m128i hi16 = _mm_srai_epi16(_mm_unpackhi_epi8(bytes, bytes), 8);
+		const __m128i q0 = _mm_srai_epi32(_mm_unpacklo_epi16(lo16, lo16), 16);
+		const __m128i q1 = _mm_srai_epi32(_mm_unpackhi_epi16(lo16, lo16), 16);
+		const __m128i q2 = _mm_srai_epi32(_mm_unpacklo_epi16(hi16, hi16), 16);
+		const __m128i q3 = _mm_srai_epi32(_mm_unpackhi_epi16(hi16, hi16), 16);
+		_mm_storeu_ps(out + i, _mm_mul_ps(_mm_cvtepi32_ps(q0), _mm_loadu_ps(window + i)));
+		_mm_storeu_ps(out + i + 4, _mm_mul_ps(_mm_cvtepi32_ps(q1), _mm_loadu_ps(window + i + 4)));
+		_mm_storeu_ps(out + i + 8, _mm_mul_ps(_mm_cvtepi32_ps(q2), _mm_loadu_ps(window + i + 8)));
+		_mm_storeu_ps(out + i + 12, _mm_mul_ps(_mm_cvtepi32_ps(q3), _mm_loadu_ps(window + i + 12)));
+	}
+	window_int8_scalar(out + i, in + i, window + i, count - i / 2);
+}
+
+__attribute__((target("avx2")))
+static inline void window_int8_avx2(float *out, const int8_t *in, const float *window, unsigned int count)
+{
+	unsigned int i = 0;
+	for (; i + 16 <= 2 * count; i += 16)
+	{
+		const __m256i lo = _mm256_cvtepi8_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i *>(in + i)));
+		const __m256i hi = _mm256_cvtepi8_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i *>(in + i + 8)));
+		_mm256_storeu_ps(out + i, _mm256_mul_ps(_mm256_cvtepi32_ps(lo), _mm256_loadu_ps(window + i)));
+		_mm256_storeu_ps(out + i + 8, _mm256_mul_ps(_mm256_cvtepi32_ps(hi), _mm256_loadu_ps(window + i + 8)));
+	}
+	window_int8_scalar(out + i, in + i, window + i, count - i / 2);
+}
+#endif
+
+/* Persistence histogram: every bin of every vector counts into one of levels
+ * dB ranges, counts[bin * levels + level] with bins in FFT order, so the
+ * increments walk the counters front to back and persistence_rle reads every
+ * bin's histogram in one piece. A level is (10 * log10(power) + offset) * inv_step,
+ * clamped to the levels there are (NaN to the lowest), so offset takes the
+ * calibration, the gain and the bottom of the lowest level. The dB values and
+ * levels are worked out a vector at a time with SIMD into the db and level
+ * scratch buffers (length each), only the increments are done one by one.
+ * Counters stop at 65535. */
+typedef void (*persistence_batch_fn)(uint16_t *counts, const float *input, unsigned int count, unsigned int length, float offset,
+	float inv_step, unsigned int levels, float *db, uint32_t *level);
+
+static inline void persistence_count(uint16_t *counts, const uint32_t *level, unsigned int length, unsigned int levels)
+{
+	for (unsigned int i = 0; i < length; ++i, counts += levels)
+	{
+		uint16_t &c = counts[level[i]];
+		c += c != 0xffff;
+	}
+}
+
+static inline void persistence_level_scalar(uint32_t *level, const float *db, unsigned int from, unsigned int length,
+	float inv_step, unsigned int levels)
+{
+	const float top = static_cast<float>(levels - 1);
+	for (unsigned int i = from; i < length; ++i)
+	{
+		float l = db[i] * inv_step;
+		level[i] = static_cast<uint32_t>(l > 0.0f ? (l < top ? l : top) : 0.0f); //NaN fails l > 0
+	}
+}
+
+static inline void persistence_batch_scalar(uint16_t *counts, const float *input, unsigned int count, unsigned int length, float offset,
+	float inv_step, unsigned int levels, float *db, uint32_t *level)
+{
+	for (unsigned int v = 0; v < count; ++v, input += length)
+	{
+		log_db_scalar(db, input, length, offset);
+		persistence_level_scalar(level, db, 0, length, inv_step, levels);
+		persistence_count(counts, level, length, levels);
+	}
+}
+
+#ifdef SPECTRUM_KERNELS_X86
+static inline void persistence_batch_sse(uint16_t *counts, const float *input, unsigned int count, unsigned int length, float offset,
+	float inv_step, unsigned int levels, float *db, uint32_t *level)
+{
+	const __m128 scale = _mm_set1_ps(inv_step), top = _mm_set1_ps(static_cast<float>(levels - 1));
+	for (unsigned int v = 0; v < count; ++v, input += length)
+	{
+		log_db_sse(db, input, length, offset);
+		unsigned int i = 0;
+		for (; i + 4 <= length; i += 4) //max gives its second operand for NaN
+		{
+			const __m128 l = _mm_min_ps(_mm_max_ps(_mm_mul_ps(_mm_loadu_ps(db + i), scale), _mm_setzero_ps()), top);
+			_mm_storeu_si128(reinterpret_cast<__m128i *>(level + i), _mm_cvttps_epi32(l));
+		}
+		persistence_level_scalar(level, db, i, length, inv_step, levels);
+		persistence_count(counts, level, length, levels);
+	}
+}
+
+__attribute__((target("avx2")))
+static inline void persistence_batch_avx2(uint16_t *counts, const float *input, unsigned int count, unsigned int length, float offset,
+	float inv_step, unsigned int levels, float *db, uint32_t *level)
+{
+	const __m256 scale = _mm256_set1_ps(inv_step), top = _mm256_set1_ps(static_cast<float>(levels - 1));
+	for (unsigned int v = 0; v < count; ++v, input += length)
+	{
+		log_db_avx2(db, input, length, offset);
+		unsigned int i = 0;
+		for (; i + 8 <= length; i += 8) //max gives its second operand for NaN
+		{
+			const __m256 l = _mm256_min_ps(_mm256_max_ps(_mm256_mul_ps(_mm256_loadu_ps(db + i), scale), _mm256_setzero_ps()), top);
+			_mm256_storeu_si256(reinterpret_cast<__m256i *>(level + i), _mm256_cvttps_epi32(l));
+		}
+		persistence_level_scalar(level, db, i, length, inv_step, levels);
+		persistence_count(counts, level, length, levels);
+	}
+}
+#endif
+
+/* Finishes a dwell in one pass per half: the FFT-ordered sum in acc goes to out
+ * lowest frequency first (fftshift as two straight copies, no per-bin branch) and
+ * in dB with offset added. Any scaling of acc (1/count, calibration) belongs in
+ * offset as 10 * log10(scale). */
+static inline void finalize_dwell(log_db_fn log_db, float *out, const float *acc, unsigned int length, float offset)
+{
+	const unsigned int half = length / 2;
+	log_db(out, acc + (length - half), half, offset); //negative frequencies
+	log_db(out + half, acc, length - half, offset); //DC and up
+}
+
+/* Spectral kurtosis and duty cycle of count FFT-ordered bins of a dwell of
+ * vectors spectra, written in order. SK = (M + 1) / (M - 1) * (M * S2 / S1^2 - 1)
+ * (Nita and Gary) with S1 and S2 the sums of the power and of its square: about 1
+ * for noise, well above for bursts and impulses, below for a steady carrier. The
+ * duty cycle is over M - 1 vectors: the first of a dwell only measures the noise. */
+static inline void moments_range(float *kurtosis, float *duty, const float *acc, const float *squares,
+	const float *crossings, unsigned int count, unsigned int vectors)
+{
+	const float m = static_cast<float>(vectors);
+	const float scale = vectors > 1 ? (m + 1.0f) / (m - 1.0f) : 0.0f;
+	const float compared = vectors > 1 ? 1.0f / (m - 1.0f) : 0.0f;
+	for (unsigned int i = 0; i < count; ++i)
+	{
+		kurtosis[i] = acc[i] > 0.0f ? scale * (m * squares[i] / (acc[i] * acc[i]) - 1.0f) : 0.0f;
+		duty[i] = crossings[i] * compared;
+	}
+}
+
+/* The same for a whole dwell, fftshifted like finalize_dwell */
+static inline void finalize_moments(float *kurtosis, float *duty, const float *acc, const float *squares,
+	const float *crossings, unsigned int length, unsigned int vectors)
+{
+	const unsigned int half = length / 2, low = length - half;
+	moments_range(kurtosis, duty, acc + low, squares + low, crossings + low, half, vectors);
+	moments_range(kurtosis + half, duty + half, acc, squares, crossings, low, vectors);
+}
+
+/* Coarser spectrum from the same dwell: the FFT-ordered sum in acc is merged
+ * factor bins at a time over the bins [begin, end) of its fftshifted order. out[j]
+ * gets the mean of each group and centre[j] its position in fftshifted bins, so
+ * the caller can convert both in bulk. Bins in [skip_begin, skip_end) (the DC
+ * spike) are left out of the means; a group with nothing else in it is dropped.
+ * Returns the number of merged bins. */
+static inline unsigned int merge_bins(float *out, float *centre, const float *acc, unsigned int length, unsigned int begin,
+	unsigned int end, unsigned int factor, unsigned int skip_begin, unsigned int skip_end)
+{
+	const unsigned int half = length / 2;
+	unsigned int merged = 0;
+	begin += (end - begin) % factor / 2; //centre the groups, the leftover goes to both ends
+	for (unsigned int group = begin; group + factor <= end; group += factor)
+	{
+		float sum = 0.0f, position = 0.0f;
+		unsigned int used = 0;
+		for (unsigned int s = group; s < group + factor; ++s)
+		{
+			if (s >= skip_begin && s < skip_end)
+				continue;
+			sum += acc[s < half ? s + (length - half) : s - half];
+			position += s;
+			++used;
+		}
+		if (used == 0)
+			continue;
+		out[merged] = sum / used;
+		centre[merged] = position / used;
+		++merged;
+	}
+	return merged;
+}
+
+/* Most values persistence_rle writes for one bin: every other level hit */
+static inline unsigned int persistence_rle_bound(unsigned int levels)
+{
+	return levels + (levels + 1) / 2 + 2;
+}
+
+/* Run-length codes the persistence histogram of the bins [begin, end) of the
+ * fftshifted spectrum (counts as persistence_batch_fn leaves them) into out,
+ * lowest frequency first. Every bin is its number of runs R, then R times its
+ * first level, the number of levels n and their n counts; levels that were never
+ * hit are left out. Returns the values written, at most persistence_rle_bound
+ * a bin. */
+static inline unsigned int persistence_rle(uint16_t *out, const uint16_t *counts, unsigned int length, unsigned int levels,
+	unsigned int begin, unsigned int end)
+{
+	const unsigned int half = length / 2;
+	uint16_t *p = out;
+	for (unsigned int s = begin; s < end; ++s)
+	{
+		const uint16_t *bin = counts + static_cast<size_t>(s < half ? s + (length - half) : s - half) * levels;
+		uint16_t *runs = p++;
+		*runs = 0;
+		for (unsigned int l = 0; l < levels; )
+		{
+			if (bin[l] == 0)
+			{
+				++l;
+				continue;
+			}
+			unsigned int first = l;
+			while (l < levels && bin[l] != 0)
+				++l;
+			*p++ = first;
+			*p++ = l - first;
+			memcpy(p, bin + first, (l - first) * sizeof(uint16_t));
+			p += l - first;
+			++*runs;
+		}
+	}
+	return p - out;
+}
+
+/* Picks the widest implementation the CPU we are running on supports */
+template <unsigned int extras>
+static inline accumulate_batch_fn select_accumulate_batch()
+{
+#ifdef SPECTRUM_KERNELS_X86
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2"))
+		return accumulate_batch_avx2<extras>;
+	if (__builtin_cpu_supports("sse2"))
+		return accumulate_batch_sse<extras>;
+#endif
+	return accumulate_batch_scalar<extras>;
+}
+
+/* ... of the kernel keeping the ACCUMULATE_ extras asked for */
+static inline accumulate_batch_fn select_accumulate_batch(unsigned int extras)
+{
+	switch (extras & (ACCUMULATE_MOMENTS | ACCUMULATE_HOLD))
+	{
+	case ACCUMULATE_MOMENTS:
+		return select_accumulate_batch<ACCUMULATE_MOMENTS>();
+	case ACCUMULATE_HOLD:
+		return select_accumulate_batch<ACCUMULATE_HOLD>();
+	case ACCUMULATE_MOMENTS | ACCUMULATE_HOLD:
+		return select_accumulate_batch<ACCUMULATE_MOMENTS | ACCUMULATE_HOLD>();
+	}
+	return select_accumulate_batch<0>();
+}
+
+static inline welford_batch_fn select_welford_batch()
+{
+#ifdef SPECTRUM_KERNELS_X86
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2"))
+		return welford_batch_avx2;
+	if (__builtin_cpu_supports("sse2"))
+		return welford_batch_sse;
+#endif
+	return welford_batch_scalar;
+}
+
+static inline log_db_fn select_log_db()
+{
+#ifdef SPECTRUM_KERNELS_X86
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2"))
+		return log_db_avx2;
+	if (__builtin_cpu_supports("sse2"))
+		return log_db_sse;
+#endif
+	return log_db_scalar;
+}
+
+static inline window_int8_fn select_window_int8()
+{
+#ifdef SPECTRUM_KERNELS_X86
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2"))
+		return window_int8_avx2;
+	if (__builtin_cpu_supports("sse2"))
+		return window_int8_sse;
+#endif
+	return window_int8_scalar;
+}
+
+static inline persistence_batch_fn select_persistence_batch()
+{
+#ifdef SPECTRUM_KERNELS_X86
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2"))
+		return persistence_batch_avx2;
+	if (__builtin_cpu_supports("sse2"))
+		return persistence_batch_sse;
+#endif
+	return persistence_batch_scalar;
+}
+
+#endif
@@ -0,0 +1,199 @@
+/*
+	gr-scan - A GNU Radio signal scanner
+	Copyright (C) 2015 Jason A. Donenfeld <Jason@zx2c4.com>. All Rights Reserved.
+	Copyright (C) 2012  Nicholas Tomlinson
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef SPECTRUM_POOL_HPP
+#define SPECTRUM_POOL_HPP
+
+#include <stdint.h>
+
+#include <vector>
+
+#include <boost/bind.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread.hpp>
+
+#include "spectrum_frontend.hpp"
+
+/* Runs a batch of spectrum_frontend Transforms on several threads. At 20 Msps and
+ * 16k point FFTs one core can't keep up, and the FFTs of a batch don't depend on
+ * each other: every thread gets a contiguous share of the vectors and a frontend
+ * (so an FFT plan) of its own, and writes each spectrum to the slot it would have
+ * had anyway, so the batch comes out in order. The calling thread does the first
+ * share itself and returns once all are done. */
+class spectrum_pool
+{
+public:
+	spectrum_pool(spectrum_frontend_sptr frontend, unsigned int threads) :
+		m_frontends(1, frontend),
+		m_input(NULL),
+		m_input8(NULL),
+		m_output(NULL),
+		m_count(0),
+		m_generation(0),
+		m_pending(0),
+		m_stop(false)
+	{
+		for (unsigned int t = 1; t < threads; ++t)
+			m_frontends.push_back(spectrum_frontend_sptr(frontend->Clone()));
+	}
+
+	~spectrum_pool()
+	{
+		Stop();
+	}
+
+	/* Threads per device for -j 0: small FFTs take less time than waking the
+	 * workers does, big ones get the cores this device's share, less one for the
+	 * source */
+	static unsigned int AutoThreads(unsigned int span, unsigned int devices)
+	{
+		if (span < parallel_span)
+			return 1;
+		unsigned int cores = boost::thread::hardware_concurrency() / (devices > 0 ? devices : 1);
+		return cores > 2 ? cores - 1 : 1;
+	}
+
+	static const unsigned int max_threads = 64; //-j beyond this is a typo, not a machine
+
+	/* The frontend all the others are clones of */
+	spectrum_frontend_sptr frontend() const
+	{
+		return m_frontends[0];
+	}
+
+	unsigned int threads() const
+	{
+		return m_frontends.size();
+	}
+
+	void Start()
+	{
+		boost::lock_guard<boost::mutex> lock(m_mutex);
+		m_stop = false;
+		for (unsigned int t = 1; t < m_frontends.size(); ++t)
+			m_workers.push_back(boost::shared_ptr<boost::thread>(new boost::thread(boost::bind(&spectrum_pool::Run, this, t, m_generation))));
+	}
+
+	void Stop()
+	{
+		{
+			boost::lock_guard<boost::mutex> lock(m_mutex);
+			m_stop = true;
+		}
+		m_wake.notify_all();
+		for (size_t t = 0; t < m_workers.size(); ++t)
+			m_workers[t]->join();
+		m_workers.clear();
+	}
+
+	/* Writes the power spectra of count vectors, one hop() apart from input, to
+	 * output one after the other: what count calls of Transform would do */
+	void Transform(const gr_complex *input, unsigned int count, float *output)
+	{
+		Batch(input, NULL, count, output);
+	}
+
+	/* The same from interleaved int8 I/Q pairs */
+	void Transform(const int8_t *input, unsigned int count, float *output)
+	{
+		Batch(NULL, input, count, output);
+	}
+
+private:
+	static const unsigned int parallel_span = 4096; //samples per FFT below which -j 0 stays on one thread
+
+	/* One of input and input8 is the batch */
+	void Batch(const gr_complex *input, const int8_t *input8, unsigned int count, float *output)
+	{
+		if (m_workers.empty() || count < 2) //one thread, not started, or nothing to share
+		{
+			Vectors(*m_frontends[0], input, input8, 0, count, output);
+			return;
+		}
+		{
+			boost::lock_guard<boost::mutex> lock(m_mutex);
+			m_input = input;
+			m_input8 = input8;
+			m_output = output;
+			m_count = count;
+			m_pending = m_frontends.size() - 1;
+			++m_generation;
+		}
+		m_wake.notify_all();
+		Share(0);
+		boost::unique_lock<boost::mutex> lock(m_mutex);
+		while (m_pending > 0)
+			m_done.wait(lock);
+	}
+
+	static void Vectors(spectrum_frontend &f, const gr_complex *input, const int8_t *input8, unsigned int begin, unsigned int end,
+		float *output)
+	{
+		for (unsigned int v = begin; v < end; ++v)
+		{
+			if (input8)
+				f.Transform(input8 + 2 * v * f.hop(), output + v * f.vector_length());
+			else
+				f.Transform(input + v * f.hop(), output + v * f.vector_length());
+		}
+	}
+
+	/* Thread t's part of the current batch */
+	void Share(unsigned int t)
+	{
+		unsigned int begin = static_cast<uint64_t>(m_count) * t / m_frontends.size();
+		unsigned int end = static_cast<uint64_t>(m_count) * (t + 1) / m_frontends.size();
+		Vectors(*m_frontends[t], m_input, m_input8, begin, end, m_output);
+	}
+
+	void Run(unsigned int t, uint64_t seen)
+	{
+		boost::unique_lock<boost::mutex> lock(m_mutex);
+		for (;;)
+		{
+			while (m_generation == seen && !m_stop)
+				m_wake.wait(lock);
+			if (m_stop)
+				break;
+			seen = m_generation;
+			lock.unlock();
+			Share(t);
+			lock.lock();
+			if (--m_pending == 0)
+				m_done.notify_one();
+		}
+	}
+
+	std::vector<spectrum_frontend_sptr> m_frontends; //one per thread, the caller's first
+	const gr_complex *m_input; //the batch being transformed, one of these
+	const int8_t *m_input8;
+	float *m_output;
+	unsigned int m_count;
+	uint64_t m_generation; //batches handed out so far
+	unsigned int m_pending; //workers still busy with the current batch
+	bool m_stop;
+	boost::mutex m_mutex;
+	boost::condition_variable m_wake; //a new batch, or stop
+	boost::condition_variable m_done; //the last worker finished its share
+	std::vector<boost::shared_ptr<boost::thread> > m_workers; //empty unless started with more than one thread
+};
+
+typedef boost::shared_ptr<spectrum_pool> spectrum_pool_sptr;
+
+#endif
@@ -0,0 +1,289 @@
+/*
+	gr-scan - A GNU Radio signal scanner
+	Copyright (C) 2015 Jason A. Donenfeld <Jason@zx2c4.com>. All Rights Reserved.
+	Copyright (C) 2012  Nicholas Tomlinson
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef SPECTRUM_PUBLISHER_HPP
+#define SPECTRUM_PUBLISHER_HPP
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <vector>
+
+#include <sys/ipc.h>
+#include <sys/shm.h>
+
+#include <boost/shared_ptr.hpp>
+#include <boost/thread.hpp>
+
+#include "dwell_log.hpp"
+#include "signal_detector.hpp"
+#include "spectrum_kernels.hpp"
+
+#define SHM_SIZE 1000000
+#define SHM_LAYOUT_VERSION 1 //the layout below; scanners that only published the bins left it 0
+
+/* A coarser spectrum of the same dwell, made by merging adjacent bins */
+struct spectrum_level
+{
+	double resolution; //Hz per merged bin
+	std::vector<float> freqs; //centre of each merged bin
+	std::vector<float> bands; //dB
+	unsigned int count; //merged bins in use
+};
+
+/* A dwell's persistence histogram, coded by persistence_rle */
+struct spectrum_persistence
+{
+	float floor; //dB at the bottom of level 0
+	float step; //dB per level
+	unsigned int levels;
+	std::vector<uint16_t> rle;
+	unsigned int size; //values of rle in use
+};
+
+/* The one output stream all devices publish into: the shared memory the monitor
+ * reads and the binary dwell log. Sinks call Publish from their finalizer threads,
+ * so dwells from different devices are serialized here and tagged with the device.
+ *
+ * Shared memory layout (ints and floats of 4 bytes):
+ *   i[0] dwell counter, bumped after each dwell is complete
+ *   f[1] total gain in dB
+ *   i[2] bins at each end of the spectrum the monitor should leave out
+ *   i[3] SHM_LAYOUT_VERSION in the upper 16 bits, the device the dwell came from in the lower 16.
+ *        The monitor reads the words after the bins, and i[2], only if the version says they are there.
+ *   i[4] number of bins n
+ *   f[5 + 2r], f[6 + 2r] frequency and level in dB of bin r, lowest frequency first
+ *   i[5 + 2n], i[6 + 2n] first bin and number of bins around DC the monitor should
+ *                        leave out (0 bins if DC isn't in the dwell, e.g. offset tuned)
+ *   i[7 + 2n] number of coarser spectra L, then for each of them, finest first:
+ *             f[p] resolution in Hz, i[p + 1] number of bins m,
+ *             f[p + 2 + 2r], f[p + 3 + 2r] frequency and level in dB of bin r
+ *   after them, at q: i[q] number of signals found E (0 without -D), f[q + 1] noise floor in dB,
+ *             f[q + 2 + 4e] ... f[q + 5 + 4e] centre, bandwidth in Hz, peak and SNR in dB of signal e
+ *   after them, at s: i[s] number of bins with statistics (n, or 0 without -B), then
+ *             f[s + 1 + 2r], f[s + 2 + 2r] spectral kurtosis and duty cycle (0 to 1) of bin r
+ *   after them, at h: i[h] number of bins with holds (n, or 0 without -e), then
+ *             f[h + 1 + 2r], f[h + 2 + 2r] max-hold and min-hold in dB of bin r over the dwell
+ *   after them, at z: i[z] number of bins with a persistence histogram (n, or 0 without -Z),
+ *             f[z + 1] dB at the bottom of level 0, f[z + 2] dB per level, i[z + 3] number of levels,
+ *             i[z + 4] number of 16 bit values V, then from z + 5 the V values of persistence_rle
+ *             packed two to an int (lower address first): for every bin the number of runs,
+ *             and for every run its first level, its number of levels and their counts.
+ *             A bin's counts add up to the FFTs in the dwell.
+ *
+ * With events_only the spectra are left out: n and L are 0 and the log gets only
+ * the signals, a few dozen bytes a dwell instead of a few kB. */
+class spectrum_publisher
+{
+public:
+	spectrum_publisher(dwell_log_sptr log, unsigned int devices, bool events_only) :
+		m_log(log),
+		m_devices(devices),
+		m_events_only(events_only),
+		m_users(0),
+		m_persistence_dropped(0),
+		shared_memory(NULL)
+	{
+		key_t key = 47192032; //some random number that must be the same in monitor shared mem module
+		int shmid;
+
+		if ((shmid = shmget(key, SHM_SIZE, IPC_CREAT | 0666)) < 0) {
+		printf("shmget error!\n");
+		}
+
+		if ((shared_memory = (uint8_t*)shmat(shmid, NULL, 0)) == (uint8_t *) -1) {
+		printf("shmat error!\n");
+		}
+	}
+
+	unsigned int devices() const
+	{
+		return m_devices;
+	}
+
+	/* Most persistence levels, up to max_levels, whose histogram of bins bins always
+	 * fits into the shared memory after the bins, the statistics and holds of every
+	 * bin and coarse floats of coarser spectra; 0 if not even one level does. What the
+	 * signals take comes on top, a histogram that doesn't fit after all is dropped. */
+	static unsigned int PersistenceLevels(unsigned int bins, unsigned int coarse, unsigned int max_levels)
+	{
+		const size_t fixed = (17 + 6 * static_cast<size_t>(bins) + coarse) * sizeof(float); //every section up to z + 5
+		if (fixed >= SHM_SIZE)
+			return 0;
+		unsigned int levels = max_levels;
+		while (levels > 0 && static_cast<size_t>(bins) * persistence_rle_bound(levels) * sizeof(uint16_t) > SHM_SIZE - fixed)
+			--levels;
+		return levels;
+	}
+
+	/* Every sink starts and stops the publisher; the log runs while any sink does */
+	void Start()
+	{
+		boost::lock_guard<boost::mutex> lock(m_mutex);
+		if (m_users++ == 0)
+			m_log->Start();
+	}
+
+	void Stop()
+	{
+		boost::lock_guard<boost::mutex> lock(m_mutex);
+		if (m_users > 0 && --m_users == 0)
+			m_log->Stop();
+	}
+
+	/* Publishes one dwell of count bins (dB, lowest frequency first) averaged over ffts FFTs,
+	 * of which the outer edge bins on each side and the dc_count from dc_first aren't worth
+	 * displaying, along with the same dwell at the coarser resolutions in levels and the
+	 * signals found in it (NULL if nobody looked), the kurtosis and duty cycle of every
+	 * bin, its max-hold and min-hold in dB and the persistence histogram (NULL if not kept).
+	 * The log keeps the full resolution and the holds, the others can be made from it. */
+	void Publish(unsigned int device, double centre, double span, float gain, unsigned int ffts,
+		const double *freqs, const float *bands0, unsigned int count, unsigned int edge,
+		unsigned int dc_first, unsigned int dc_count, const std::vector<spectrum_level> &levels,
+		const std::vector<signal_event> *events, float noise_floor, const float *kurtosis, const float *duty,
+		const float *max_hold, const float *min_hold, const spectrum_persistence *persistence)
+	{
+		if (m_events_only)
+			count = edge = dc_first = dc_count = 0;
+		else
+			m_log->Append(device, centre, span, gain, ffts, bands0, count, max_hold, min_hold); //gr-scan-log2txt recreates the old text files
+		if (events)
+		{
+			std::vector<dwell_log_event> records(events->size());
+			for (size_t e = 0; e < events->size(); ++e)
+			{
+				records[e].centre = (*events)[e].centre;
+				records[e].bandwidth = (*events)[e].bandwidth;
+				records[e].peak = (*events)[e].peak;
+				records[e].snr = (*events)[e].snr;
+				records[e].reserved = 0;
+			}
+			m_log->AppendEvents(device, centre, span, gain, ffts, records.empty() ? NULL : &records[0], records.size());
+		}
+
+		boost::lock_guard<boost::mutex> lock(m_mutex);
+		float *f_shm = (float*)shared_memory;
+		int *i_shm = (int*)shared_memory;
+		i_shm[2] = edge;
+		i_shm[3] = SHM_LAYOUT_VERSION << 16 | device;
+		i_shm[4] = count;
+		f_shm[1] = gain;
+
+		int rpos = 0;
+		for(unsigned int r = 0; r < count; r++)
+		{
+			f_shm[5 + rpos*2] = static_cast<float>(freqs[r]); //the monitor reads floats
+			f_shm[6 + rpos*2] = bands0[r];
+			rpos++;
+		}
+		i_shm[5 + count*2] = dc_first;
+		i_shm[6 + count*2] = dc_count;
+
+		unsigned int p = 8 + count*2;
+		unsigned int published = 0;
+		for (size_t l = 0; l < levels.size() && !m_events_only; ++l)
+		{
+			const spectrum_level &level = levels[l];
+			if (level.count == 0) //too coarse or too fine for this dwell
+				continue;
+			if ((p + 2 + level.count*2) * sizeof(float) > SHM_SIZE) //the coarsest ones are the smallest, but don't write past the end
+				break;
+			f_shm[p] = level.resolution;
+			i_shm[p + 1] = level.count;
+			for (unsigned int r = 0; r < level.count; r++)
+			{
+				f_shm[p + 2 + r*2] = level.freqs[r];
+				f_shm[p + 3 + r*2] = level.bands[r];
+			}
+			p += 2 + level.count*2;
+			++published;
+		}
+		i_shm[7 + count*2] = published;
+
+		if ((p + 2) * sizeof(float) <= SHM_SIZE)
+		{
+			unsigned int found = 0;
+			for (; events && found < events->size() && (p + 6 + found*4) * sizeof(float) <= SHM_SIZE; ++found)
+			{
+				const signal_event &event = (*events)[found];
+				f_shm[p + 2 + found*4] = event.centre;
+				f_shm[p + 3 + found*4] = event.bandwidth;
+				f_shm[p + 4 + found*4] = event.peak;
+				f_shm[p + 5 + found*4] = event.snr;
+			}
+			i_shm[p] = found;
+			f_shm[p + 1] = noise_floor;
+
+			unsigned int s = p + 2 + found*4, with = 0;
+			if (kurtosis && (s + 1 + count*2) * sizeof(float) <= SHM_SIZE)
+			{
+				for (; with < count; ++with)
+				{
+					f_shm[s + 1 + with*2] = kurtosis[with];
+					f_shm[s + 2 + with*2] = duty[with];
+				}
+			}
+			if ((s + 1) * sizeof(float) <= SHM_SIZE)
+				i_shm[s] = with;
+
+			unsigned int h = s + 1 + with*2, held = 0;
+			if (max_hold && (h + 1 + count*2) * sizeof(float) <= SHM_SIZE)
+			{
+				for (; held < count; ++held)
+				{
+					f_shm[h + 1 + held*2] = max_hold[held];
+					f_shm[h + 2 + held*2] = min_hold[held];
+				}
+			}
+			if ((h + 1) * sizeof(float) <= SHM_SIZE)
+				i_shm[h] = held;
+
+			unsigned int z = h + 1 + held*2;
+			bool fits = persistence && count > 0 && (z + 5) * sizeof(float) + persistence->size * sizeof(uint16_t) <= SHM_SIZE;
+			if (persistence && count > 0 && !fits && m_persistence_dropped++ % 100 == 0)
+				fprintf(stderr, "[!] persistence histogram doesn't fit into shared memory, %u dropped\n", m_persistence_dropped);
+			if ((z + 5) * sizeof(float) <= SHM_SIZE)
+			{
+				i_shm[z] = fits ? count : 0;
+				f_shm[z + 1] = fits ? persistence->floor : 0.0f;
+				f_shm[z + 2] = fits ? persistence->step : 0.0f;
+				i_shm[z + 3] = fits ? persistence->levels : 0;
+				i_shm[z + 4] = fits ? persistence->size : 0;
+				if (fits && persistence->size > 0)
+					memcpy(shared_memory + (z + 5) * sizeof(float), &persistence->rle[0], persistence->size * sizeof(uint16_t));
+			}
+		}
+
+		i_shm[0]++;
+	}
+
+private:
+	dwell_log_sptr m_log;
+	unsigned int m_devices;
+	bool m_events_only; //publish the signals found, not the spectra
+	unsigned int m_users; //sinks that have started us
+	unsigned int m_persistence_dropped; //histograms left out for lack of room
+	boost::mutex m_mutex;
+	uint8_t *shared_memory; //memory shared with external monitor
+};
+
+typedef boost::shared_ptr<spectrum_publisher> spectrum_publisher_sptr;
+
+#endif
@@ -0,0 +1,370 @@
+/*
+	gr-scan - A GNU Radio signal scanner
+	Copyright (C) 2015 Jason A. Donenfeld <Jason@zx2c4.com>. All Rights Reserved.
+	Copyright (C) 2012  Nicholas Tomlinson
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef SWEEP_PLAN_HPP
+#define SWEEP_PLAN_HPP
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+#include <stdint.h>
+#include <time.h>
+
+#include <boost/shared_ptr.hpp>
+
+/* One range of the sweep plan. A pass over it visits start, start + step, ...
+ * up to the first centre at or above end. */
+struct sweep_segment
+{
+	double start; //Hz
+	double end; //Hz
+	double step; //Hz, 0 until Finish picks the default
+	double interval; //seconds between passes, 0 = no deadline (background)
+	int priority; //breaks ties between equal deadlines, higher first
+	double resolution; //Hz, zoom in to this resolution; 0 = the sweep's own
+	unsigned int decimation; //zoom: decimate by this before the FFT, 1 = no zoom
+	double lo_offset; //tune the LO this far below each centre and shift the rest digitally
+	unsigned int first; //published window of the (fftshifted) spectrum: first bin
+	unsigned int bins; //and number of bins, all of them if the whole spectrum is published
+
+	static const unsigned int dc_guard = 3; //bins either side of the DC bin that the LO leakage spoils
+
+	/* Parses "START:END[:INTERVAL[:PRIORITY[:STEP[:RBW]]]]" (MHz, MHz, s, -, MHz, kHz);
+	 * a STEP of 0 means the default. Spaces work as separators too, so plan file lines
+	 * use the same syntax. False if malformed. */
+	bool Parse(const std::string &spec)
+	{
+		std::string s = spec;
+		std::replace(s.begin(), s.end(), ':', ' ');
+		double step_mhz = 0.0, rbw_khz = 0.0;
+		interval = 0.0;
+		priority = 0;
+		char extra;
+		int n = sscanf(s.c_str(), "%lf %lf %lf %d %lf %lf %c", &start, &end, &interval, &priority, &step_mhz, &rbw_khz, &extra);
+		if (n < 2 || n > 6)
+			return false;
+		start *= 1000000.0;
+		end *= 1000000.0;
+		step = step_mhz * 1000000.0;
+		resolution = rbw_khz * 1000.0;
+		decimation = 1;
+		lo_offset = 0.0;
+		first = 0;
+		bins = 0;
+		return start <= end && step >= 0.0 && interval >= 0.0 && resolution >= 0.0;
+	}
+
+	/* Works out the zoom and the default step once the sample rate and FFT size are
+	 * known. usable is the fraction of each spectrum worth publishing. Zooming needs
+	 * a decimation of at least 4, so the band of interest fits beside the DC spike
+	 * at a quarter of the sample rate; false if the resolution asks for less.
+	 *
+	 * With offset set, unzoomed dwells are offset tuned: the LO goes below the
+	 * centre so that the usable bins above DC (past dc_guard, short of the spoilt
+	 * edge) are centred on it, and only those bins are published. Every published
+	 * bin is then good and consecutive dwells can abut, so the default step becomes
+	 * the width of that window. The shift is a whole number of bins, which makes it
+	 * free: the window is just picked out of the spectrum when it is published. */
+	bool Finish(double sample_rate, unsigned int fft_width, double default_step, double usable, bool offset)
+	{
+		first = 0;
+		bins = fft_width;
+		if (resolution > 0.0)
+		{
+			decimation = static_cast<unsigned int>(sample_rate / (fft_width * resolution) + 0.5);
+			if (decimation < 4)
+				return false;
+			lo_offset = sample_rate / 4.0;
+		}
+		else if (offset)
+		{
+			unsigned int edge = static_cast<unsigned int>(fft_width * (1.0 - usable) / 2.0 + 1e-6);
+			first = fft_width / 2 + dc_guard + 1;
+			if (first + edge >= fft_width)
+				return false;
+			bins = fft_width - edge - first;
+			lo_offset = (first + bins / 2.0 - fft_width / 2.0) * sample_rate / fft_width;
+		}
+		if (step <= 0.0)
+		{
+			if (decimation > 1)
+				step = usable * sample_rate / decimation;
+			else if (offset)
+				step = bins * sample_rate / fft_width;
+			else
+				step = default_step;
+		}
+		return true;
+	}
+
+	/* Number of dwells in one pass */
+	unsigned int Dwells() const
+	{
+		return end > start ? static_cast<unsigned int>(ceil((end - start) / step - 1e-9)) + 1 : 1;
+	}
+};
+
+/* Where one dwell goes and how its samples are processed */
+struct sweep_dwell
+{
+	double centre; //centre of the published spectrum, Hz
+	double lo; //frequency to tune the source to, Hz
+	unsigned int decimation; //zoom decimation, 1 = none
+	unsigned int first; //first bin of the spectrum to publish
+	unsigned int bins; //bins to publish
+};
+
+/* Splits a plan between devices. Every segment is cut into contiguous pieces of
+ * nearly equal dwell count, one per device, so each device carries the same share
+ * of every deadline. Segments with fewer dwells than there are devices are spread
+ * round robin instead of all landing on the first device. */
+static inline std::vector<std::vector<sweep_segment> > split_sweep_plan(const std::vector<sweep_segment> &segments, unsigned int devices)
+{
+	std::vector<std::vector<sweep_segment> > plans(devices);
+	unsigned int next = 0; //device that gets the first piece of the next segment
+	for (size_t i = 0; i < segments.size(); ++i)
+	{
+		const sweep_segment &segment = segments[i];
+		unsigned int dwells = segment.Dwells();
+		unsigned int pieces = dwells < devices ? dwells : devices;
+		for (unsigned int p = 0; p < pieces; ++p)
+		{
+			unsigned int first = static_cast<unsigned int>(static_cast<uint64_t>(p) * dwells / pieces);
+			unsigned int last = static_cast<unsigned int>(static_cast<uint64_t>(p + 1) * dwells / pieces) - 1;
+			sweep_segment piece = segment;
+			piece.start = segment.start + first * segment.step;
+			piece.end = segment.start + last * segment.step;
+			plans[(next + p) % devices].push_back(piece);
+		}
+		next = (next + pieces) % devices;
+	}
+	return plans;
+}
+
+/* Loads a plan file: one segment per line in sweep_segment::Parse syntax, '#' starts
+ * a comment. Returns the line number of the first bad line, -1 if the file can't be
+ * read, 0 on success. */
+static inline int load_sweep_plan(const char *path, std::vector<sweep_segment> &segments)
+{
+	FILE *in = fopen(path, "r");
+	if (!in)
+		return -1;
+	char line[1024];
+	int number = 0;
+	while (fgets(line, sizeof(line), in))
+	{
+		++number;
+		std::string s(line);
+		s = s.substr(0, s.find('#'));
+		if (s.find_first_not_of(" \t\r\n") == std::string::npos)
+			continue;
+		sweep_segment segment;
+		if (!segment.Parse(s))
+		{
+			fclose(in);
+			return number;
+		}
+		segments.push_back(segment);
+	}
+	fclose(in);
+	return 0;
+}
+
+/* Seconds on a clock that doesn't jump with the wall clock */
+static inline double sweep_plan_now()
+{
+	timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Earliest-deadline-first dwell scheduler. Each segment is a periodic task: a pass
+ * is released every interval seconds and is due one interval after its release.
+ * Released segments sit in a heap by deadline, the rest in a heap by release time,
+ * so every decision is O(log n) however many segments there are. A segment keeps
+ * its place in the middle of a pass when another one preempts it. When nothing
+ * is due, the segment released next starts its pass early rather than leaving the
+ * radio idle. Passes that finish after their deadline are reported and counted. */
+class sweep_plan
+{
+public:
+	sweep_plan(const std::vector<sweep_segment> &segments) :
+		m_finishing(-1),
+		m_missed(0)
+	{
+		double now = sweep_plan_now();
+		for (size_t i = 0; i < segments.size(); ++i)
+		{
+			state s;
+			s.segment = segments[i];
+			s.cursor = 0;
+			s.dwells = s.segment.Dwells();
+			s.release = now;
+			s.deadline = s.segment.interval > 0.0 ? now + s.segment.interval : HUGE_VAL;
+			s.pass_start = now;
+			s.missed = 0;
+			m_segments.push_back(s);
+			m_ready.push_back(i);
+		}
+		std::make_heap(m_ready.begin(), m_ready.end(), by_deadline(m_segments));
+	}
+
+	size_t size() const
+	{
+		return m_segments.size();
+	}
+
+	unsigned int missed() const
+	{
+		return m_missed;
+	}
+
+	/* Called when the previous dwell is finished: returns the next one */
+	sweep_dwell Next(double now)
+	{
+		if (m_finishing >= 0) //the last dwell of a pass just ended
+		{
+			FinishPass(m_finishing, now);
+			m_finishing = -1;
+		}
+
+		by_release release_order(m_segments);
+		by_deadline deadline_order(m_segments);
+		while (!m_pending.empty() && m_segments[m_pending.front()].release <= now)
+		{
+			size_t i = m_pending.front();
+			std::pop_heap(m_pending.begin(), m_pending.end(), release_order);
+			m_pending.pop_back();
+			m_ready.push_back(i);
+			std::push_heap(m_ready.begin(), m_ready.end(), deadline_order);
+		}
+		if (m_ready.empty()) //nothing due, get ahead on whatever comes next
+		{
+			size_t i = m_pending.front();
+			std::pop_heap(m_pending.begin(), m_pending.end(), release_order);
+			m_pending.pop_back();
+			state &s = m_segments[i];
+			s.release = now;
+			if (s.segment.interval > 0.0)
+				s.deadline = now + s.segment.interval;
+			m_ready.push_back(i);
+			std::push_heap(m_ready.begin(), m_ready.end(), deadline_order);
+		}
+
+		size_t i = m_ready.front();
+		state &s = m_segments[i];
+		if (s.cursor == 0)
+			s.pass_start = now;
+		sweep_dwell dwell;
+		dwell.centre = s.segment.start + s.cursor * s.segment.step;
+		dwell.lo = dwell.centre - s.segment.lo_offset;
+		dwell.decimation = s.segment.decimation;
+		dwell.first = s.segment.first;
+		dwell.bins = s.segment.bins;
+		++s.cursor;
+		if (s.cursor >= s.dwells) //last dwell of this pass, it leaves the ready heap
+		{
+			std::pop_heap(m_ready.begin(), m_ready.end(), deadline_order);
+			m_ready.pop_back();
+			m_finishing = i;
+		}
+		return dwell;
+	}
+
+private:
+	struct state
+	{
+		sweep_segment segment;
+		unsigned int cursor; //dwells done in the current pass
+		unsigned int dwells; //dwells in a pass
+		double release; //when the current pass may start
+		double deadline; //when it should be done
+		double pass_start; //when its first dwell started
+		unsigned int missed;
+	};
+
+	/* Heap orders: std heaps keep the largest element on top, so these are "later than" */
+	struct by_deadline
+	{
+		by_deadline(const std::vector<state> &s) : m_s(s) {}
+		bool operator()(size_t a, size_t b) const
+		{
+			if (m_s[a].deadline != m_s[b].deadline)
+				return m_s[a].deadline > m_s[b].deadline;
+			if (m_s[a].segment.priority != m_s[b].segment.priority)
+				return m_s[a].segment.priority < m_s[b].segment.priority;
+			return m_s[a].release > m_s[b].release; //round robin between background segments
+		}
+		const std::vector<state> &m_s;
+	};
+
+	struct by_release
+	{
+		by_release(const std::vector<state> &s) : m_s(s) {}
+		bool operator()(size_t a, size_t b) const
+		{
+			if (m_s[a].release != m_s[b].release)
+				return m_s[a].release > m_s[b].release;
+			return m_s[a].segment.priority < m_s[b].segment.priority;
+		}
+		const std::vector<state> &m_s;
+	};
+
+	void FinishPass(size_t i, double now)
+	{
+		state &s = m_segments[i];
+		double seconds = now - s.pass_start;
+		fprintf(stderr, "[*] Finished %.1f - %.1f MHz in %.2f s (%.1f dwells/s)\n", s.segment.start / 1000000.0,
+			s.segment.end / 1000000.0, seconds, seconds > 0 ? s.cursor / seconds : 0.0);
+		if (now > s.deadline)
+		{
+			++s.missed;
+			++m_missed;
+			fprintf(stderr, "[!] %.1f - %.1f MHz missed its %.2f s revisit deadline by %.2f s (%u times, %u in total)\n",
+				s.segment.start / 1000000.0, s.segment.end / 1000000.0, s.segment.interval, now - s.deadline, s.missed, m_missed);
+		}
+
+		s.cursor = 0;
+		if (s.segment.interval > 0.0)
+		{
+			s.release += s.segment.interval;
+			if (s.release < now) //running late, don't try to catch up on passes we've lost
+				s.release = now;
+			s.deadline = s.release + s.segment.interval;
+		}
+		else
+			s.release = now;
+		m_pending.push_back(i);
+		std::push_heap(m_pending.begin(), m_pending.end(), by_release(m_segments));
+	}
+
+	std::vector<state> m_segments;
+	std::vector<size_t> m_ready; //heap of released segments, earliest deadline on top
+	std::vector<size_t> m_pending; //heap of segments waiting for their next release, earliest on top
+	long m_finishing; //segment whose last dwell of the pass is in progress, or -1
+	unsigned int m_missed;
+};
+
+typedef boost::shared_ptr<sweep_plan> sweep_plan_sptr;
+
+#endif
@@ -0,0 +1,426 @@
+/*
+	gr-scan - A GNU Radio signal scanner
+	Copyright (C) 2015 Jason A. Donenfeld <Jason@zx2c4.com>. All Rights Reserved.
+	Copyright (C) 2012  Nicholas Tomlinson
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef SYNTHETIC_SOURCE_HPP
+#define SYNTHETIC_SOURCE_HPP
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <algorithm>
+#include <cmath>
+#include <map>
+#include <string>
+#include <vector>
+
+#include <boost/shared_ptr.hpp>
+#include <boost/thread.hpp>
+
+#include <gnuradio/sync_block.h>
+#include <gnuradio/io_signature.h>
+#include <gnuradio/fft/fft.h>
+#include <pmt/pmt.h>
+#include <volk/volk.h>
+
+/* One transmitter in a synthetic scene. Levels are dBFS of total power at 0 dB
+ * gain; the gains the scanner sets scale everything like a real front end would.
+ *
+ *   tone FREQ LEVEL                  unmodulated carrier
+ *   ofdm FREQ BANDWIDTH LEVEL        flat block of QPSK subcarriers
+ *   oven FREQ BANDWIDTH LEVEL [HZ]   magnetron: on for half of every mains cycle
+ *                                    (default 60 Hz), sweeping over BANDWIDTH
+ *   noise LEVEL                      white noise over the whole capture
+ *
+ * Frequencies and bandwidths in MHz. */
+struct synthetic_emitter
+{
+	enum { TONE, OFDM, OVEN, NOISE };
+
+	int kind;
+	double freq; //Hz
+	double bandwidth; //Hz
+	double level; //dBFS
+	double mains; //Hz, ovens only
+
+	bool Parse(const std::string &spec)
+	{
+		char name[16];
+		double a = 0.0, b = 0.0, c = 0.0, d = 60.0;
+		char extra;
+		int n = sscanf(spec.c_str(), "%15s %lf %lf %lf %lf %c", name, &a, &b, &c, &d, &extra);
+		std::string k(name);
+		freq = bandwidth = 0.0;
+		mains = 60.0;
+		if (k == "tone" && n == 3)
+		{
+			kind = TONE;
+			freq = a * 1000000.0;
+			level = b;
+		}
+		else if (k == "ofdm" && n == 4)
+		{
+			kind = OFDM;
+			freq = a * 1000000.0;
+			bandwidth = b * 1000000.0;
+			level = c;
+		}
+		else if (k == "oven" && (n == 4 || n == 5))
+		{
+			kind = OVEN;
+			freq = a * 1000000.0;
+			bandwidth = b * 1000000.0;
+			level = c;
+			mains = d;
+		}
+		else if (k == "noise" && n == 2)
+		{
+			kind = NOISE;
+			level = a;
+		}
+		else
+			return false;
+		return bandwidth >= 0.0 && mains > 0.0;
+	}
+};
+
+/* Same format as load_sweep_plan: 0 when the whole file parsed, the line number
+ * of the first bad line, -1 if it can't be read */
+static inline int load_synthetic_scene(const char *path, std::vector<synthetic_emitter> &emitters)
+{
+	FILE *in = fopen(path, "r");
+	if (!in)
+		return -1;
+	char line[1024];
+	int number = 0;
+	while (fgets(line, sizeof(line), in))
+	{
+		++number;
+		std::string s(line);
+		s = s.substr(0, s.find('#'));
+		if (s.find_first_not_of(" \t\r\n") == std::string::npos)
+			continue;
+		synthetic_emitter emitter;
+		if (!emitter.Parse(s))
+		{
+			fclose(in);
+			return number;
+		}
+		emitters.push_back(emitter);
+	}
+	fclose(in);
+	return 0;
+}
+
+/* Something to look at anywhere between FM broadcast and 5.8 GHz */
+static inline std::vector<synthetic_emitter> default_synthetic_scene()
+{
+	static const char *scene[] = {
+		"noise -60",
+		"tone 96.5 -20", "tone 101.1 -25", "tone 104.3 -30", //FM broadcast
+		"tone 433.92 -35", "tone 915 -40", //ISM telemetry
+		"ofdm 751 10 -30", "ofdm 1960 20 -35", //LTE downlinks
+		"ofdm 2437 20 -30", "ofdm 5785 20 -40", //WiFi
+		"oven 2450 20 -20 60" //microwave oven
+	};
+	std::vector<synthetic_emitter> emitters;
+	for (unsigned int i = 0; i < sizeof(scene) / sizeof(scene[0]); ++i)
+	{
+		synthetic_emitter emitter;
+		emitter.Parse(scene[i]);
+		emitters.push_back(emitter);
+	}
+	return emitters;
+}
+
+/* Signal generator that stands in for an osmosdr source: set_center_freq moves a
+ * virtual LO over the scene, and only the transmitters inside the capture band
+ * are rendered. Runs as fast as the sink consumes, so a sweep can be benchmarked
+ * without hardware. Tags the first sample after each retune with rx_freq, like
+ * sources that report the retune point. */
+class synthetic_source : public gr::sync_block
+{
+public:
+	synthetic_source(double sample_rate, const std::vector<synthetic_emitter> &scene) :
+		gr::sync_block("synthetic_source",
+			gr::io_signature::make(0, 0, 0),
+			gr::io_signature::make(1, 1, sizeof(gr_complex))),
+		m_rate(sample_rate),
+		m_lo(0.0),
+		m_time(0),
+		m_retuned(true),
+		m_cpu(0),
+		m_rx_freq_key(pmt::intern("rx_freq"))
+	{
+		srand48(1); //the same scene every run
+		double noise = -200.0;
+		for (size_t i = 0; i < scene.size(); ++i)
+		{
+			const synthetic_emitter &e = scene[i];
+			double power = pow(10.0, e.level / 10.0);
+			if (e.kind == synthetic_emitter::NOISE)
+				noise = e.level;
+			else if (e.kind == synthetic_emitter::TONE)
+				AddLayer(e, e.freq, 0.0, table_sptr(new std::vector<gr_complex>(4096, gr_complex(sqrt(power), 0.0f))));
+			else if (e.kind == synthetic_emitter::OFDM)
+			{
+				/* Wide blocks are tiled, so every tile fits into the capture whole
+				 * (a tile hanging over the band edge would alias back in) */
+				unsigned int tiles = static_cast<unsigned int>(ceil(e.bandwidth / (max_tile() * m_rate)));
+				double width = e.bandwidth / tiles;
+				table_sptr table(new std::vector<gr_complex>(GetOfdmTable(width / m_rate, power / tiles)));
+				for (unsigned int t = 0; t < tiles; ++t)
+					AddLayer(e, e.freq - e.bandwidth / 2.0 + (t + 0.5) * width, width, table);
+			}
+			else
+			{
+				AddLayer(e, e.freq, e.bandwidth, table_sptr());
+				m_layers.back().amplitude = sqrt(power);
+			}
+		}
+		m_noise = GetNoiseTable(pow(10.0, noise / 10.0));
+	}
+
+	double set_center_freq(double freq)
+	{
+		boost::lock_guard<boost::mutex> lock(m_mutex);
+		m_lo = freq;
+		m_retuned = true;
+		return freq;
+	}
+
+	/* There is only one gain stage really, the names are kept apart for get_gain */
+	double set_gain(double gain)
+	{
+		boost::lock_guard<boost::mutex> lock(m_mutex);
+		m_gains.clear();
+		m_gains["RF"] = gain;
+		return gain;
+	}
+
+	double set_gain(double gain, const std::string &name)
+	{
+		boost::lock_guard<boost::mutex> lock(m_mutex);
+		m_gains[name] = gain;
+		return gain;
+	}
+
+	double get_gain(const std::string &name)
+	{
+		boost::lock_guard<boost::mutex> lock(m_mutex);
+		return m_gains[name];
+	}
+
+	/* CPU seconds spent generating samples so far */
+	double cpu_seconds()
+	{
+		boost::lock_guard<boost::mutex> lock(m_mutex);
+		return m_cpu / 1e9;
+	}
+
+	int work(int noutput_items, gr_vector_const_void_star &input_items, gr_vector_void_star &output_items)
+	{
+		uint64_t begin = ThreadCpu();
+		gr_complex *out = static_cast<gr_complex *>(output_items[0]);
+		const unsigned int n = noutput_items;
+
+		boost::lock_guard<boost::mutex> lock(m_mutex);
+		if (m_retuned)
+		{
+			add_item_tag(0, nitems_written(0), m_rx_freq_key, pmt::from_double(m_lo));
+			m_retuned = false;
+		}
+
+		size_t pos = m_time % m_noise.size();
+		for (unsigned int done = 0; done < n;)
+		{
+			unsigned int chunk = std::min<size_t>(n - done, m_noise.size() - pos);
+			memcpy(out + done, &m_noise[pos], chunk * sizeof(gr_complex));
+			done += chunk;
+			pos = 0;
+		}
+
+		if (m_scratch.size() < n)
+			m_scratch.resize(n);
+		for (size_t l = 0; l < m_layers.size(); ++l)
+		{
+			layer &layer = m_layers[l];
+			double offset = layer.freq - m_lo;
+			if (!layer.table)
+			{
+				if (fabs(offset) < m_rate / 2.0 + layer.width / 2.0)
+					RenderOven(layer, out, n);
+			}
+			else if (fabs(offset) + layer.width / 2.0 <= m_rate / 2.0)
+				RenderTable(layer, offset, out, n);
+		}
+
+		double gain = 0.0;
+		for (std::map<std::string, double>::const_iterator it = m_gains.begin(); it != m_gains.end(); ++it)
+			gain += it->second;
+		volk_32f_s32f_multiply_32f(reinterpret_cast<float *>(out), reinterpret_cast<const float *>(out),
+			pow(10.0, gain / 20.0), 2 * n);
+
+		m_time += n;
+		m_cpu += ThreadCpu() - begin;
+		return noutput_items;
+	}
+
+private:
+	/* widest OFDM tile, as a fraction of the sample rate; keeps the PFB's published 80% covered right up to its edges */
+	static double max_tile() { return 0.1; }
+
+	typedef boost::shared_ptr<const std::vector<gr_complex> > table_sptr;
+
+	struct layer
+	{
+		double freq; //centre
+		double width;
+		double mains; //ovens only
+		float amplitude; //ovens only, tables carry their own level
+		double phase; //ovens only, carrier phase
+		size_t start; //where in the table this layer is at time 0
+		table_sptr table; //baseband waveform played in a loop, shared by the tiles of a block; none for ovens
+	};
+
+	void AddLayer(const synthetic_emitter &e, double freq, double width, table_sptr table)
+	{
+		layer l;
+		l.freq = freq;
+		l.width = width;
+		l.mains = e.mains;
+		l.amplitude = 0.0f;
+		l.phase = 0.0;
+		l.table = table;
+		l.start = table ? static_cast<size_t>(drand48() * table->size()) : 0; //tiles of one block don't repeat in step
+		m_layers.push_back(l);
+	}
+
+	/* Plays the layer's table shifted to offset Hz from the LO; the phase follows
+	 * from the absolute sample time, so a retune doesn't restart the waveform */
+	void RenderTable(const layer &layer, double offset, gr_complex *out, unsigned int n)
+	{
+		double cycles = offset / m_rate;
+		gr_complex inc(cos(2.0 * M_PI * cycles), sin(2.0 * M_PI * cycles));
+		double turns = fmod(cycles * static_cast<double>(m_time), 1.0);
+		gr_complex phase(cos(2.0 * M_PI * turns), sin(2.0 * M_PI * turns));
+
+		const std::vector<gr_complex> &table = *layer.table;
+		size_t pos = (layer.start + m_time) % table.size();
+		for (unsigned int done = 0; done < n;)
+		{
+			unsigned int chunk = std::min<size_t>(n - done, table.size() - pos);
+			volk_32fc_s32fc_x2_rotator_32fc(&m_scratch[0], &table[pos], inc, &phase, chunk);
+			volk_32f_x2_add_32f(reinterpret_cast<float *>(out + done), reinterpret_cast<const float *>(out + done),
+				reinterpret_cast<const float *>(&m_scratch[0]), 2 * chunk);
+			done += chunk;
+			pos = 0;
+		}
+	}
+
+	/* A magnetron runs off half-wave rectified mains: it transmits for one half of
+	 * every cycle, drifting down and back up in frequency as the anode voltage rises
+	 * and falls. Only the part of the sweep inside the capture is drawn. */
+	void RenderOven(layer &layer, gr_complex *out, unsigned int n)
+	{
+		const double per_sample = layer.mains / m_rate; //mains cycles
+		double cycle = fmod(static_cast<double>(m_time) * per_sample, 1.0);
+		for (unsigned int i = 0; i < n; ++i, cycle += per_sample)
+		{
+			if (cycle >= 1.0)
+				cycle -= 1.0;
+			if (cycle >= 0.5)
+				continue;
+			double offset = layer.freq + layer.width * (0.5 - sin(2.0 * M_PI * cycle)) - m_lo; //top of the band to the bottom and back
+			layer.phase += 2.0 * M_PI * offset / m_rate;
+			if (fabs(offset) < 0.45 * m_rate)
+				out[i] += gr_complex(layer.amplitude * cos(layer.phase), layer.amplitude * sin(layer.phase));
+		}
+		layer.phase = fmod(layer.phase, 2.0 * M_PI);
+	}
+
+	/* 64 symbols of width (fraction of the sample rate) worth of random QPSK
+	 * subcarriers, 1024 point IFFT plus a 1/8 cyclic prefix, scaled to power */
+	static std::vector<gr_complex> GetOfdmTable(double width, double power)
+	{
+		const unsigned int nfft = 1024, prefix = nfft / 8, symbols = 64;
+		int active = static_cast<int>(width * nfft + 0.5);
+		if (active < 1)
+			active = 1;
+		gr::fft::fft_complex ifft(nfft, false);
+		std::vector<gr_complex> table;
+		for (unsigned int s = 0; s < symbols; ++s)
+		{
+			gr_complex *in = ifft.get_inbuf();
+			std::fill(in, in + nfft, gr_complex(0.0f, 0.0f));
+			for (int k = -active / 2; k < active - active / 2; ++k)
+				in[(k + nfft) % nfft] = gr_complex(drand48() < 0.5 ? -1.0f : 1.0f, drand48() < 0.5 ? -1.0f : 1.0f);
+			ifft.execute();
+			const gr_complex *symbol = ifft.get_outbuf();
+			table.insert(table.end(), symbol + nfft - prefix, symbol + nfft);
+			table.insert(table.end(), symbol, symbol + nfft);
+		}
+		double sum = 0.0;
+		for (size_t i = 0; i < table.size(); ++i)
+			sum += std::norm(table[i]);
+		float scale = sqrt(power * table.size() / sum);
+		for (size_t i = 0; i < table.size(); ++i)
+			table[i] *= scale;
+		return table;
+	}
+
+	/* Complex Gaussian noise of the given total power (Box-Muller) */
+	static std::vector<gr_complex> GetNoiseTable(double power)
+	{
+		std::vector<gr_complex> table(1 << 18);
+		double sigma = sqrt(power / 2.0);
+		for (size_t i = 0; i < table.size(); ++i)
+		{
+			double r = sigma * sqrt(-2.0 * log(1.0 - drand48()));
+			double a = 2.0 * M_PI * drand48();
+			table[i] = gr_complex(r * cos(a), r * sin(a));
+		}
+		return table;
+	}
+
+	static uint64_t ThreadCpu()
+	{
+		timespec ts;
+		clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+		return static_cast<uint64_t>(ts.tv_sec) * 1000000000ULL + ts.tv_nsec;
+	}
+
+	double m_rate;
+	double m_lo; //virtual LO
+	uint64_t m_time; //samples produced so far
+	bool m_retuned; //tag the next sample
+	uint64_t m_cpu; //ns of thread CPU spent in work
+	std::map<std::string, double> m_gains;
+	std::vector<layer> m_layers;
+	std::vector<gr_complex> m_noise;
+	std::vector<gr_complex> m_scratch;
+	pmt::pmt_t m_rx_freq_key;
+	boost::mutex m_mutex;
+};
+
+typedef boost::shared_ptr<synthetic_source> synthetic_source_sptr;
+
+#endif
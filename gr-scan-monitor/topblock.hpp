@@ -18,110 +18,171 @@
 */
 
 
+#include <algorithm>
 #include <cmath>
 #include <stdint.h>
 
 #include <gnuradio/top_block.h>
 #include <osmosdr/source.h>
-#include <gnuradio/blocks/stream_to_vector.h>
-#include <gnuradio/fft/fft_vcc.h>
-#include <gnuradio/blocks/complex_to_mag_squared.h>
-#include <gnuradio/filter/single_pole_iir_filter_ff.h>
-#include <gnuradio/blocks/nlog10_ff.h>
+#include "spectrum_frontend.hpp"
+#include "spectrum_pool.hpp"
+#include "sweep_plan.hpp"
+#include "dwell_log.hpp"
+#include "spectrum_publisher.hpp"
+#include "scan_stats.hpp"
+#include "scan_source.hpp"
+#include "synthetic_source.hpp"
+#include "sigmf_source.hpp"
+#include "hackrf_source.hpp"
+#include "iq_recorder.hpp"
+#include "gain_memory.hpp"
+#include "scan_options.hpp"
+#include "fft_wisdom.hpp"
 #include "scanner_sink.hpp"
 
 class TopBlock : public gr::top_block
 {
 public:
-	TopBlock(double start_freq, double end_freq, double sample_rate,
-		 double fft_width, double step, unsigned int avg_size, 
-		double gain_a, float gain_m, float gain_if, float total_gain, int use_AGC) :
+	TopBlock(const std::vector<std::string> &devices, const std::vector<sweep_segment> &segments, const scan_options &options) :
 		gr::top_block("Top Block"),
-		vector_length(fft_width),
-		window(GetWindow(vector_length)),
-		source(osmosdr::source::make()), /* OsmoSDR Source */
-		stv(gr::blocks::stream_to_vector::make(sizeof(float) * 2, vector_length)), /* Stream to vector */
-		/* Based on the logpwrfft (a block implemented in python) */
-		fft(gr::fft::fft_vcc::make(vector_length, true, window, false, 1)),
-		ctf(gr::blocks::complex_to_mag_squared::make(vector_length)),
-		iir(gr::filter::single_pole_iir_filter_ff::make(1.0, vector_length)),
-		lg(gr::blocks::nlog10_ff::make(10, vector_length, -20 * std::log10(float(vector_length)) -10 * std::log10(float(GetWindowPower() / vector_length))))
-		/* Sink - this does most of the interesting work */
+		vector_length(options.fft_width),
+		window(options.pfb ? spectrum_frontend::GetPfbWindow(vector_length, pfb_taps) : spectrum_frontend::GetWindow(vector_length)),
+		hop(options.pfb ? vector_length / options.pfb : spectrum_frontend::GetHop(vector_length, options.overlap)),
+		log(new dwell_log("logs", options.log_segment_minutes, options.quantize_log)), /* Binary dwell log */
+		publisher(new spectrum_publisher(log, devices.size(), options.events_only)), /* Shared memory + log, all devices publish here */
+		stats(new scan_stats(options.stats_path, options.stats_interval, devices.size())), /* Per-dwell timing */
+		gains(options.use_AGC && !options.gain_memory_path.empty() ? new gain_memory(options.gain_memory_path) : NULL) /* AGC gains by frequency, all devices */
 	{
-		/* Set up the OsmoSDR Source */
-		source->set_sample_rate(sample_rate);
-		source->set_center_freq(start_freq);
-		source->set_freq_corr(0.0);
-
-		const std::vector<std::string>gains = source->get_gain_names();
-		for(std::vector<std::string>::const_iterator ii = gains.begin(); ii != gains.end(); ++ii)
+		/* Every device gets its own share of the plan and its own source -> sink chain;
+		 * GNU Radio runs each block on a thread of its own, so the chains scan in parallel */
+		std::vector<std::vector<sweep_segment> > plans = split_sweep_plan(segments, devices.size());
+		bool wisdom = load_fft_wisdom(options.fft_wisdom_path); //before any frontend plans its FFT
+		unsigned int fft_threads = options.fft_threads;
+		if (fft_threads == 0)
+			fft_threads = spectrum_pool::AutoThreads(std::max(window.size(), vector_length), devices.size());
+		if (fft_threads > 1)
+			printf("[*] %u FFT threads per device\n", fft_threads);
+		uint64_t planning = 0;
+		for (unsigned int d = 0; d < devices.size(); ++d)
 		{
-			printf("gain: %s\n", ii->c_str());
-		}
-
-		source->set_gain_mode(false);
-		if(total_gain > 0)
-			source->set_gain(total_gain);
-		else
-		{
-			source->set_gain(gain_m, "BB");
-			if(!use_AGC)
+			if (plans[d].empty())
 			{
-				source->set_gain(gain_a, "RF");
-				source->set_gain(gain_if, "IF");
+				fprintf(stderr, "[!] nothing left to scan for device %u (%s), not using it\n", d, devices[d].c_str());
+				continue;
 			}
+			sweep_plan_sptr plan(new sweep_plan(plans[d]));
+			sweep_dwell start = plan->Next(sweep_plan_now()); //first dwell of the plan
+
+			scan_source_sptr source = MakeSource(devices[d], options.sample_rate, start.lo);
+			if(options.gain_total > 0)
+				source->set_gain(options.gain_total);
 			else
 			{
-				source->set_gain(0, "RF");
-				source->set_gain(0, "IF");
+				source->set_gain(options.gain_m, "BB");
+				if(!options.use_AGC)
+				{
+					source->set_gain(options.gain_a, "RF");
+					source->set_gain(options.gain_if, "IF");
+				}
+				else
+				{
+					source->set_gain(0, "RF");
+					source->set_gain(0, "IF");
+				}
 			}
-		}
 
-		float resulting_gain = source->get_gain("RF") + source->get_gain("BB") + source->get_gain("IF");
-
-		sink = make_scanner_sink(source, vector_length, start_freq, end_freq, sample_rate, step, avg_size, resulting_gain, use_AGC);
-		/* Set up the connections */
-		connect(source, 0, stv, 0);
-		connect(stv, 0, fft, 0);
-		connect(fft, 0, ctf, 0);
-//		connect(ctf, 0, iir, 0);
-//		connect(iir, 0, lg, 0);
-//		connect(lg, 0, sink, 0);
-		connect(ctf, 0, sink, 0);
+			float resulting_gain = source->get_gain("RF") + source->get_gain("BB") + source->get_gain("IF");
+
+			/* Window (or filterbank), FFT and |X|^2 (what stream_to_vector -> fft_vcc -> complex_to_mag_squared did), on fft_threads threads */
+			uint64_t begin = scan_stats_now();
+			spectrum_pool_sptr pool(new spectrum_pool(spectrum_frontend_sptr(new spectrum_frontend(vector_length, window, hop)), fft_threads));
+			planning += scan_stats_now() - begin;
+			/* Raw IQ tap, one recording per device */
+			iq_recorder_sptr recorder;
+			if (!options.record_dir.empty())
+				recorder.reset(new iq_recorder(options.record_dir, d, options.sample_rate, options.record_segment_mb));
+			/* Sink - this does most of the interesting work */
+			scanner_sink_sptr sink = make_scanner_sink(source, pool, vector_length, plan, start, resulting_gain, publisher, d, stats, recorder, gains, options);
+			/* Set up the connections - the sink takes the raw stream and does the FFTs itself.
+			 * It needs span() samples in one piece for an FFT, 8 vectors with the filterbank,
+			 * and GNU Radio never asks a sink's forecast(), so the buffer is sized here */
+			source->set_min_output_buffer(2 * pool->frontend()->span());
+			connect(source->block(), 0, sink, 0);
+			sources.push_back(source);
+			sinks.push_back(sink);
+		}
+		printf("[*] FFT plans took %.1f ms%s\n", planning / 1e6, wisdom ? " (with saved wisdom)" : "");
+		save_fft_wisdom(options.fft_wisdom_path);
 	}
 
+	const std::vector<scan_source_sptr> &scan_sources() const { return sources; }
+	scan_stats_sptr timing() const { return stats; }
+
 private:
-	/* http://en.wikipedia.org/w/index.php?title=Window_function&oldid=508445914 */
-	std::vector<float> GetWindow(size_t n)
+	/* "synth" or "synth=SCENE" is the signal generator, "replay=FILE" loops raw gr_complex
+	 * samples from FILE, "sigmf=PATH" plays back what -R recorded, "hackrf8" or "hackrf8=SERIAL"
+	 * is a HackRF delivering its native 8 bit samples, anything else goes to osmosdr */
+	static scan_source_sptr MakeSource(const std::string &device, double sample_rate, double freq)
 	{
-		std::vector<float> w;
-		w.resize(n);
+		if (device == "synth" || device.compare(0, 6, "synth=") == 0)
+		{
+			std::vector<synthetic_emitter> scene;
+			if (device == "synth")
+				scene = default_synthetic_scene();
+			else
+			{
+				int line = load_synthetic_scene(device.c_str() + 6, scene);
+				if (line != 0)
+				{
+					fprintf(stderr, line < 0 ? "[!] can't read scene %s\n" : "[!] %s:%d: bad emitter\n", device.c_str() + 6, line);
+					exit(1);
+				}
+			}
+			synthetic_source_sptr source(new synthetic_source(sample_rate, scene));
+			source->set_center_freq(freq);
+			return scan_source_sptr(new block_scan_source<synthetic_source>(source));
+		}
+		if (device.compare(0, 7, "replay=") == 0)
+			return scan_source_sptr(new replay_scan_source(device.substr(7)));
+		if (device.compare(0, 6, "sigmf=") == 0)
+		{
+			sigmf_source_sptr source(new sigmf_source(device.substr(6), sample_rate));
+			source->set_center_freq(freq);
+			return scan_source_sptr(new block_scan_source<sigmf_source>(source));
+		}
 
-		double a = 0.16;
-		double a0 = (1.0 - a)/2.0;
-		double a1 = 0.5;
-		double a2 = a/2.0;
+		if (device == "hackrf8" || device.compare(0, 8, "hackrf8=") == 0)
+		{
+			hackrf_source_sptr source(new hackrf_source(device.size() > 8 ? device.substr(8) : "", sample_rate));
+			source->set_center_freq(freq);
+			return scan_source_sptr(new block_scan_source<hackrf_source>(source));
+		}
 
-		for (unsigned int i = 0; i < n; ++i)
-			w[i] = a0 - a1 * ::cos((2.0 * 3.14159 * static_cast<double>(i))/static_cast<double>(n - 1)) + a2 * ::cos((4.0 * 3.14159 * static_cast<double>(i))/static_cast<double>(n - 1));
-		return w;
-	}
+		/* Set up the OsmoSDR Source */
+		osmosdr::source::sptr source = osmosdr::source::make(device);
+		source->set_sample_rate(sample_rate);
+		source->set_center_freq(freq);
+		source->set_freq_corr(0.0);
 
-	double GetWindowPower()
-	{
-		double total = 0.0;
-		BOOST_FOREACH (double d, window)
-			total += d * d;
-		return total;
+		const std::vector<std::string>gains = source->get_gain_names();
+		for(std::vector<std::string>::const_iterator ii = gains.begin(); ii != gains.end(); ++ii)
+		{
+			printf("gain: %s\n", ii->c_str());
+		}
+
+		source->set_gain_mode(false);
+		return scan_source_sptr(new block_scan_source<osmosdr::source>(source));
 	}
 
+	static const unsigned int pfb_taps = 8; //filterbank taps per bin
+
 	size_t vector_length;
 	std::vector<float> window;
-	osmosdr::source::sptr source;
-	gr::blocks::stream_to_vector::sptr stv;
-	gr::fft::fft_vcc::sptr fft;
-	gr::blocks::complex_to_mag_squared::sptr ctf;
-	gr::filter::single_pole_iir_filter_ff::sptr iir;
-	gr::blocks::nlog10_ff::sptr lg;
-	scanner_sink_sptr sink;
+	unsigned int hop;
+	dwell_log_sptr log;
+	spectrum_publisher_sptr publisher;
+	scan_stats_sptr stats;
+	gain_memory_sptr gains;
+	std::vector<scan_source_sptr> sources;
+	std::vector<scanner_sink_sptr> sinks;
 };
@@ -0,0 +1,134 @@
+/*
+	gr-scan - A GNU Radio signal scanner
+	Copyright (C) 2015 Jason A. Donenfeld <Jason@zx2c4.com>. All Rights Reserved.
+	Copyright (C) 2012  Nicholas Tomlinson
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef ZOOM_STAGE_HPP
+#define ZOOM_STAGE_HPP
+
+#include <cmath>
+#include <vector>
+
+#include <gnuradio/types.h>
+#include <volk/volk.h>
+
+/* Zoom FFT front half: shifts the band of interest to DC, low-pass filters it and
+ * keeps every decimation-th sample, so an FFT of the usual size over the output
+ * resolves decimation times finer than over the raw samples. The filter only runs
+ * at the output rate (one dot product per kept sample), which is what makes this
+ * cheaper than one FFT decimation times larger. */
+class zoom_stage
+{
+public:
+	zoom_stage() :
+		m_decimation(1),
+		m_phase(1.0f, 0.0f),
+		m_phase_inc(1.0f, 0.0f)
+	{
+	}
+
+	unsigned int decimation() const
+	{
+		return m_decimation;
+	}
+
+	/* Sets up for a new dwell: shift by shift cycles per sample, then decimate.
+	 * Drops anything left over from the previous dwell. */
+	void Configure(unsigned int decimation, double shift)
+	{
+		if (decimation != m_decimation)
+		{
+			m_decimation = decimation;
+			m_taps = decimation > 1 ? GetTaps(decimation) : std::vector<float>();
+		}
+		m_phase_inc = gr_complex(cos(2.0 * M_PI * shift), sin(2.0 * M_PI * shift));
+		Reset();
+	}
+
+	void Reset()
+	{
+		m_phase = gr_complex(1.0f, 0.0f);
+		m_input.clear();
+		m_output.clear();
+	}
+
+	/* Shifts, filters and decimates count samples onto the end of the output */
+	void Push(const gr_complex *samples, unsigned int count)
+	{
+		size_t old = m_input.size();
+		m_input.resize(old + count);
+		volk_32fc_s32fc_x2_rotator_32fc(&m_input[old], samples, m_phase_inc, &m_phase, count);
+
+		const size_t ntaps = m_taps.size();
+		size_t i = 0;
+		for (; i + ntaps <= m_input.size(); i += m_decimation)
+		{
+			gr_complex out;
+			volk_32fc_32f_dot_prod_32fc(&out, &m_input[i], &m_taps[0], ntaps);
+			m_output.push_back(out);
+		}
+		m_input.erase(m_input.begin(), m_input.begin() + i); //keep what the next outputs still need
+	}
+
+	const gr_complex *data() const
+	{
+		return m_output.empty() ? NULL : &m_output[0];
+	}
+
+	unsigned int size() const
+	{
+		return m_output.size();
+	}
+
+	/* Drops the first count output samples, once they have been transformed */
+	void Consume(unsigned int count)
+	{
+		m_output.erase(m_output.begin(), m_output.begin() + count);
+	}
+
+	/* Blackman-windowed sinc, 16 taps per unit of decimation. The cutoff sits at 80%
+	 * of the output Nyquist frequency, so what aliases back lands in the outer bins
+	 * the edge trimming drops anyway. Unity gain at DC. */
+	static std::vector<float> GetTaps(unsigned int decimation)
+	{
+		const unsigned int n = 16 * decimation + 1;
+		const double cutoff = 0.8 * 0.5 / decimation; //cycles per input sample
+		std::vector<float> taps(n);
+		double sum = 0.0;
+		for (unsigned int i = 0; i < n; ++i)
+		{
+			double x = i - (n - 1) / 2.0;
+			double sinc = x == 0.0 ? 2.0 * cutoff : sin(2.0 * M_PI * cutoff * x) / (M_PI * x);
+			double window = 0.42 - 0.5 * cos(2.0 * M_PI * i / (n - 1)) + 0.08 * cos(4.0 * M_PI * i / (n - 1));
+			taps[i] = sinc * window;
+			sum += taps[i];
+		}
+		for (unsigned int i = 0; i < n; ++i)
+			taps[i] /= sum;
+		return taps; //symmetric, so no need to reverse them for the dot product
+	}
+
+private:
+	unsigned int m_decimation;
+	std::vector<float> m_taps;
+	gr_complex m_phase; //rotator state, carried across Push calls
+	gr_complex m_phase_inc;
+	std::vector<gr_complex> m_input; //shifted samples the filter hasn't finished with
+	std::vector<gr_complex> m_output; //decimated samples waiting for the FFT
+};
+
+#endif
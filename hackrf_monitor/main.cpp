@@ -268,6 +268,7 @@ void fill_spectrum_data()
 
 #define SHM_SIZE 1000000
 //1mb - more than we normally need, just in case of strange input parameters
+#define SHM_LAYOUT_VERSION 1 //edge, DC and coarser spectra; older scanners leave the upper half of i[3] at 0
 
 uint8_t *shared_memory = NULL;
 
@@ -292,6 +293,55 @@ int last_scan_id = 0; //last scan ID that we processed
 float current_gain = 0;
 float centr_freq = 0;
 
+/* Averages one published coarse spectrum into sp: each of its bins covers every
+ * point of our grid within resolution/2 of its frequency */
+void load_scan_level(float *sp, const float *level, int count, float resolution, float norm_avg_param)
+{
+	for(int r = 0; r < count; r++)
+	{
+		float freq = level[r*2];
+		float value = level[r*2 + 1];
+		int begin = (freq - resolution/2 - full_sp_start_freq) / full_sp_freq_step;
+		int end = (freq + resolution/2 - full_sp_start_freq) / full_sp_freq_step;
+		if(end <= begin) end = begin + 1; //coarser than the grid or not, every bin lands somewhere
+		for(int freq_pos = begin; freq_pos < end; freq_pos++)
+		{
+			if(freq_pos < 1 || freq_pos >= full_sp_size) continue;
+			if(sp[freq_pos] <= no_signal_value)
+				sp[freq_pos] = value;
+			else
+				sp[freq_pos] = norm_avg_param * sp[freq_pos] + (1.0 - norm_avg_param) * value;
+		}
+	}
+}
+
+/* The scanner publishes the dwell at coarser resolutions after the full one, finest
+ * first: the narrow detector (and the display) read the finest, the wide detector
+ * the coarsest, so nothing needs smoothing here. False if there are none. */
+int load_scan_levels(const float *f_levels, int room, int levels, float norm_avg_param)
+{
+	const int *i_levels = (const int*)f_levels;
+	if(levels <= 0 || levels > 16) return 0;
+	int p = 0;
+	for(int l = 0; l < levels; l++) //room is what is left of the shared memory, in floats
+	{
+		if(p + 2 > room || i_levels[p + 1] <= 0 || i_levels[p + 1] > (room - p - 2)/2) return 0;
+		p += 2 + i_levels[p + 1]*2;
+	}
+	p = 0;
+	for(int l = 0; l < levels; l++)
+	{
+		float resolution = f_levels[p];
+		int count = i_levels[p + 1];
+		if(l == 0)
+			load_scan_level(full_spectrum_proc, f_levels + p + 2, count, resolution, norm_avg_param);
+		if(l == levels - 1)
+			load_scan_level(full_spectrum_proc_wide, f_levels + p + 2, count, resolution, norm_avg_param);
+		p += 2 + count*2;
+	}
+	return 1;
+}
+
 void load_scan_data()
 {
 	float *f_shm = (float*)shared_memory;
@@ -315,8 +365,20 @@ void load_scan_data()
 	int fill_cp = (full_sp_min_filled_data + full_sp_max_filled_data)/2;
 	if(centr_pos - fill_cp < 2000 && !need_update_detector) need_update_detector = 1;
 	
-	int min_point = num_points/4;
-	int max_point = 3*num_points/4;
+	int layout = (unsigned int)i_shm[3] >> 16;
+	int edge = num_points/4; //what a plain windowed FFT spoils at each end
+	int dc_first = num_points/2 - 3; //and the LO in the middle
+	int dc_end = num_points/2 + 4;
+	int levels = 0;
+	if(layout >= SHM_LAYOUT_VERSION) //the scanner says which bins are spoilt and publishes coarser spectra
+	{
+		edge = i_shm[2];
+		dc_first = i_shm[5 + num_points*2]; //none if offset tuned
+		dc_end = dc_first + i_shm[6 + num_points*2];
+		levels = i_shm[7 + num_points*2];
+	}
+	int min_point = edge;
+	int max_point = num_points - edge;
 	if(num_points > 10000) //emulator case
 	{
 		min_point = 100;
@@ -327,7 +389,7 @@ void load_scan_data()
 		float freq = f_shm[5 + r*2];
 		float value = f_shm[6 + r*2];
 		if(gain_mod != 0) value += gain_add;
-		if(r < 10 || r > num_points-10 || (r > num_points/2-4 && r < num_points/2+4)) continue;
+		if(r >= dc_first && r < dc_end) continue;
 
 		int freq_pos = (freq - full_sp_start_freq) / full_sp_freq_step;
 		if(freq_pos < 1 || freq_pos >= full_sp_size) continue;
@@ -354,10 +416,16 @@ void load_scan_data()
 //			full_spectrum_proc[freq_pos] = full_spectrum_avg[freq_pos] / full_spectrum_avgZ[freq_pos];
 		}
 	}
+	if(load_scan_levels(f_shm + 8 + num_points*2, SHM_SIZE/4 - 8 - num_points*2, levels, norm_avg_param))
+	{
+		fill_spectrum_data();
+		return;
+	}
+	//a scanner that doesn't publish coarser spectra: smooth the full resolution instead
 	for(int r = min_point; r < max_point; r++)
 	{
 		float freq = f_shm[5 + r*2];
-		if(r < 10 || r > num_points-10 || (r > num_points/2-4 && r < num_points/2+4)) continue;
+		if(r >= dc_first && r < dc_end) continue;
 		int freq_pos = (freq - full_sp_start_freq) / full_sp_freq_step;
 
 		full_spectrum_proc[freq_pos] = 0;
@@ -415,6 +483,7 @@ void clear_all_data()
 		full_spectrum_avgZ[x] = 0.0000001;
 		full_spectrum_max[x] = no_signal_value;
 		full_spectrum_proc[x] = no_signal_value;
+		full_spectrum_proc_wide[x] = no_signal_value;
 	}
 	full_sp_max_filled_data = 0;
 	full_sp_min_filled_data = full_sp_size;